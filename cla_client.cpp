@@ -0,0 +1,84 @@
+// cla-client: forwards its command line to a running `cla -serve <socket>`
+// and behaves like cla itself (same arguments, files, stdout, stderr and
+// exit code), so it can stand in for CUSTOMTOOL in Makefile.defs.
+//
+// The socket is taken from $CLA_SOCKET, defaulting to /tmp/cla.sock.
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cla_protocol.h"
+
+using namespace claproto;
+
+static std::string ReadStdin() {
+    std::string In;
+    char Buf[65536];
+    ssize_t N;
+    while ((N = ::read(0, Buf, sizeof(Buf))) > 0)
+        In.append(Buf, N);
+    return In;
+}
+
+int main(int argc, char **argv) {
+    const char *Path = getenv("CLA_SOCKET");
+    if (!Path || !*Path) Path = "/tmp/cla.sock";
+
+    sockaddr_un Addr;
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sun_family = AF_UNIX;
+    if (strlen(Path) >= sizeof(Addr.sun_path)) {
+        fprintf(stderr, "cla-client: socket path too long: %s\n", Path);
+        return 1;
+    }
+    strcpy(Addr.sun_path, Path);
+
+    int FD = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (FD < 0 || connect(FD, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) < 0) {
+        fprintf(stderr, "cla-client: cannot connect to %s: %s (is `cla -serve %s` running?)\n",
+                Path, strerror(errno), Path);
+        return 1;
+    }
+
+    char Cwd[PATH_MAX];
+    if (!getcwd(Cwd, sizeof(Cwd))) {
+        perror("cla-client: getcwd");
+        return 1;
+    }
+
+    bool Sent = sendFrame(FD, claproto::Cwd, Cwd);
+    for (int i = 1; i < argc && Sent; ++i)
+        Sent = sendFrame(FD, Arg, argv[i]);
+    Sent = Sent && sendFrame(FD, Run, "");
+
+    Tag T;
+    std::string Payload;
+    while (Sent && recvFrame(FD, T, Payload)) {
+        switch (T) {
+        case NeedStdin:
+            Sent = sendFrame(FD, Data, ReadStdin());
+            break;
+        case Stdout:
+            writeAll(1, Payload.data(), Payload.size());
+            break;
+        case Stderr:
+            writeAll(2, Payload.data(), Payload.size());
+            break;
+        case Exit:
+            close(FD);
+            return atoi(Payload.c_str());
+        default:
+            fprintf(stderr, "cla-client: unexpected frame '%c'\n", T);
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "cla-client: connection to %s lost\n", Path);
+    return 1;
+}
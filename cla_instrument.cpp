@@ -0,0 +1,400 @@
+// -do-profile: make every annotated loop count how often its header runs
+// and how often its backedges are taken, and write the counts as a CLAP
+// profile (cla_profile.h) when the program exits.
+//
+// The counters are a thread_local [N x [2 x i64]] array indexed by the
+// loop's position in the module, so the hot path is a plain load, add and
+// store with no atomics or shared cache lines. Loop ids only appear in the
+// shared table { id, headers, backedges } the profile is written from.
+// The first time a thread enters a function with loops, it registers a
+// thread exit hook, the way C++ thread_local destructors are registered.
+// The hook adds the thread's counters to the table. An atexit handler then
+// writes the table. The main thread's hook runs inside exit(), before the
+// atexit handlers.
+//
+// The hook is glibc's __cxa_thread_atexit_impl, referenced weakly: on a C
+// library without it, nothing is registered and only the counts of the
+// thread calling exit() are kept.
+//
+// A profile already at the path is added to, not replaced, if the same
+// program wrote it: same header and the same loop ids in the same order.
+// Runs of one program then accumulate, like gcov's .gcda files. Anything
+// else there is overwritten. Two runs exiting at the same moment may still
+// lose one's counts; give them their own $CLA_PROFILE and merge with cla-prof.
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+#include "cla_metadata.h"
+#include "cla_profile.h"
+#include "cla_stats.h"
+
+using namespace llvm;
+
+// The id cla gave L, from a latch whose innermost loop is L: a latch shared
+// with an enclosing loop names the inner one. None also if the header cannot
+// take a counter (an EH pad) or a backedge cannot be split (indirectbr).
+static Optional<uint64_t> AnnotatedLoopId(Loop *L, LoopInfo &LI) {
+    if (L->getHeader()->getFirstInsertionPt() == L->getHeader()->end()) return None;
+    SmallVector<BasicBlock *, 4> Latches;
+    L->getLoopLatches(Latches);
+    for (BasicBlock *Latch : Latches) {
+        if (isa<IndirectBrInst>(Latch->getTerminator()) || isa<CallBrInst>(Latch->getTerminator()))
+            return None;
+    }
+    for (BasicBlock *Latch : Latches) {
+        if (LI.getLoopFor(Latch) != L) continue;
+        bool Malformed;
+        MDNode *ID = Latch->getTerminator()->getMetadata(LLVMContext::MD_loop);
+        if (Optional<CLALoopProperties> P = ReadLoopID(ID, Malformed)) return P->Loop.Id;
+    }
+    return None;
+}
+
+// Counter Which (0 headers, 1 backedges) of loop Index += Delta.
+static void Increment(IRBuilder<> &B, GlobalVariable *Counts, unsigned Index, unsigned Which,
+                      Value *Delta) {
+    Value *Ptr = B.CreateInBoundsGEP(Counts->getValueType(), Counts,
+                                     {B.getInt64(0), B.getInt64(Index), B.getInt64(Which)});
+    Value *Old = B.CreateLoad(B.getInt64Ty(), Ptr);
+    B.CreateStore(B.CreateAdd(Old, Delta), Ptr);
+}
+
+// Count the backedge from Latch to L's header.
+static void CountBackedge(Loop *L, BasicBlock *Latch, unsigned Index, GlobalVariable *Counts,
+                          DominatorTree &DT, LoopInfo &LI) {
+    BasicBlock *Header = L->getHeader();
+    IRBuilder<> B(Latch->getTerminator());
+    auto *BI = dyn_cast<BranchInst>(Latch->getTerminator());
+    if (BI && BI->isConditional() && BI->getSuccessor(0) != BI->getSuccessor(1)) {
+        // branch free: add whether the branch goes back to the header
+        Value *Taken = BI->getCondition();
+        if (BI->getSuccessor(1) == Header) Taken = B.CreateNot(Taken);
+        Increment(B, Counts, Index, 1, B.CreateZExt(Taken, B.getInt64Ty()));
+        return;
+    }
+    if (!BI) {
+        // switch and friends: count on a block of its own on the edge, which
+        // becomes the latch and so takes over the loop ID. A latch listed
+        // once per edge gives up the ID with its last one.
+        Instruction *Term = Latch->getTerminator();
+        MDNode *ID = Term->getMetadata(LLVMContext::MD_loop);
+        BasicBlock *Edge = SplitEdge(Latch, Header, &DT, &LI);
+        Edge->getTerminator()->setMetadata(LLVMContext::MD_loop, ID);
+        if (!is_contained(successors(Latch), Header))
+            Term->setMetadata(LLVMContext::MD_loop, nullptr);
+        B.SetInsertPoint(Edge->getTerminator());
+    }
+    Increment(B, Counts, Index, 1, B.getInt64(1));
+}
+
+// Builds the module-level runtime once the number of loops is known.
+class ProfileRuntime {
+public:
+    ProfileRuntime(Module &M, ArrayRef<uint64_t> Ids, const std::string &DefaultPath)
+        : M(M), Ctx(M.getContext()), I64(Type::getInt64Ty(Ctx)),
+          I8Ptr(Type::getInt8PtrTy(Ctx)), SizeT(M.getDataLayout().getIntPtrType(Ctx)),
+          N(Ids.size()) {
+        auto *CountsTy = ArrayType::get(ArrayType::get(I64, 2), N);
+        Counts = new GlobalVariable(M, CountsTy, false, GlobalValue::InternalLinkage,
+                                    ConstantAggregateZero::get(CountsTy), "__cla_prof_counts",
+                                    nullptr, GlobalValue::GeneralDynamicTLSModel);
+        Live = new GlobalVariable(M, Type::getInt1Ty(Ctx), false, GlobalValue::InternalLinkage,
+                                  ConstantInt::getFalse(Ctx), "__cla_prof_live", nullptr,
+                                  GlobalValue::GeneralDynamicTLSModel);
+
+        auto *RecordTy = StructType::get(I64, I64, I64);
+        SmallVector<Constant *, 64> Records;
+        for (uint64_t Id : Ids) {
+            Records.push_back(ConstantStruct::get(
+                    RecordTy, {ConstantInt::get(I64, Id), ConstantInt::get(I64, 0),
+                               ConstantInt::get(I64, 0)}));
+        }
+        auto *TableTy = ArrayType::get(RecordTy, N);
+        Table = new GlobalVariable(M, TableTy, false, GlobalValue::InternalLinkage,
+                                   ConstantArray::get(TableTy, Records), "__cla_prof_table");
+
+        // the file header of cla_profile.h
+        auto *HeaderTy = StructType::get(ArrayType::get(Type::getInt8Ty(Ctx), 4),
+                                         Type::getInt32Ty(Ctx), I64);
+        Constant *Magic = ConstantDataArray::getRaw("CLAP", 4, Type::getInt8Ty(Ctx));
+        Header = new GlobalVariable(
+                M, HeaderTy, true, GlobalValue::PrivateLinkage,
+                ConstantStruct::get(HeaderTy, {Magic, ConstantInt::get(Type::getInt32Ty(Ctx), 1),
+                                               ConstantInt::get(I64, N)}),
+                "__cla_prof_header");
+        Path = DefaultPath;
+
+        buildThreadExit();
+        buildRegister();
+        buildMerge();
+        buildWrite();
+        buildInit();
+    }
+
+    GlobalVariable *Counts;
+
+    // Register the calling thread on entry to F, unless it already is.
+    void registerOnEntry(Function &F) {
+        BasicBlock &Entry = F.getEntryBlock();
+        BasicBlock::iterator At = Entry.getFirstInsertionPt();
+        while (isa<AllocaInst>(*At)) ++At;
+        IRBuilder<> B(&*At);
+        Value *Unregistered = B.CreateNot(B.CreateLoad(B.getInt1Ty(), Live));
+        Instruction *Then = SplitBlockAndInsertIfThen(
+                Unregistered, &*At, false, MDBuilder(Ctx).createBranchWeights(1, 1 << 20));
+        B.SetInsertPoint(Then);
+        B.CreateCall(Register);
+    }
+
+private:
+    Function *define(StringRef Name, FunctionType *Ty) {
+        Function *F = Function::Create(Ty, GlobalValue::InternalLinkage, Name, M);
+        F->addFnAttr(Attribute::NoInline);
+        return F;
+    }
+
+    // Add the calling thread's counters to the table and clear them, so a
+    // second call is harmless.
+    void buildThreadExit() {
+        ThreadExit = define("__cla_prof_thread_exit",
+                            FunctionType::get(Type::getVoidTy(Ctx), {I8Ptr}, false));
+        BasicBlock *Entry = BasicBlock::Create(Ctx, "entry", ThreadExit);
+        BasicBlock *Body = BasicBlock::Create(Ctx, "loop", ThreadExit);
+        BasicBlock *Done = BasicBlock::Create(Ctx, "done", ThreadExit);
+        IRBuilder<> B(Entry);
+        B.CreateBr(Body);
+
+        B.SetInsertPoint(Body);
+        PHINode *I = B.CreatePHI(I64, 2, "i");
+        I->addIncoming(B.getInt64(0), Entry);
+        for (unsigned Which = 0; Which < 2; ++Which) {
+            Value *From = B.CreateInBoundsGEP(Counts->getValueType(), Counts,
+                                              {B.getInt64(0), I, B.getInt64(Which)});
+            Value *To = B.CreateInBoundsGEP(Table->getValueType(), Table,
+                                            {B.getInt64(0), I, B.getInt32(Which + 1)});
+            B.CreateAtomicRMW(AtomicRMWInst::Add, To, B.CreateLoad(I64, From), MaybeAlign(8),
+                              AtomicOrdering::Monotonic);
+            B.CreateStore(B.getInt64(0), From);
+        }
+        Value *Next = B.CreateAdd(I, B.getInt64(1));
+        I->addIncoming(Next, Body);
+        B.CreateCondBr(B.CreateICmpEQ(Next, B.getInt64(N)), Done, Body);
+
+        B.SetInsertPoint(Done);
+        B.CreateRetVoid();
+    }
+
+    void buildRegister() {
+        Register = define("__cla_prof_register", FunctionType::get(Type::getVoidTy(Ctx), false));
+        IRBuilder<> B(BasicBlock::Create(Ctx, "entry", Register));
+        B.CreateStore(B.getTrue(), Live);
+        // glibc's hook behind C++ thread_local destructors, weak so that the
+        // program still links (and counts its main thread) without it
+        FunctionCallee AtThreadExit = M.getOrInsertFunction(
+                "__cxa_thread_atexit_impl", B.getInt32Ty(), ThreadExit->getType(), I8Ptr, I8Ptr);
+        auto *Hook = cast<GlobalValue>(AtThreadExit.getCallee()->stripPointerCasts());
+        if (Hook->isDeclaration()) Hook->setLinkage(GlobalValue::ExternalWeakLinkage);
+        BasicBlock *Call = BasicBlock::Create(Ctx, "register", Register);
+        BasicBlock *Done = BasicBlock::Create(Ctx, "done", Register);
+        B.CreateCondBr(B.CreateIsNull(AtThreadExit.getCallee()), Done, Call);
+
+        B.SetInsertPoint(Call);
+        auto *DSOHandle = cast<GlobalVariable>(M.getOrInsertGlobal("__dso_handle", B.getInt8Ty()));
+        DSOHandle->setVisibility(GlobalValue::HiddenVisibility);
+        B.CreateCall(AtThreadExit, {ThreadExit, ConstantPointerNull::get(I8Ptr), DSOHandle});
+        B.CreateBr(Done);
+
+        B.SetInsertPoint(Done);
+        B.CreateRetVoid();
+    }
+
+    // Add the counts in the profile at the argument to the table, if this
+    // program wrote it: exactly as long as ours, same header and the same ids
+    // in the same order. Anything else is left alone to be overwritten.
+    void buildMerge() {
+        Merge = define("__cla_prof_merge",
+                       FunctionType::get(Type::getVoidTy(Ctx), {I8Ptr}, false));
+        BasicBlock *Entry = BasicBlock::Create(Ctx, "entry", Merge);
+        BasicBlock *Open = BasicBlock::Create(Ctx, "open", Merge);
+        BasicBlock *Read = BasicBlock::Create(Ctx, "read", Merge);
+        BasicBlock *Compare = BasicBlock::Create(Ctx, "compare", Merge);
+        BasicBlock *Check = BasicBlock::Create(Ctx, "check", Merge);
+        BasicBlock *CheckNext = BasicBlock::Create(Ctx, "check.next", Merge);
+        BasicBlock *Add = BasicBlock::Create(Ctx, "add", Merge);
+        BasicBlock *Free = BasicBlock::Create(Ctx, "free", Merge);
+        BasicBlock *Done = BasicBlock::Create(Ctx, "done", Merge);
+        IRBuilder<> B(Entry);
+
+        FunctionCallee Malloc = M.getOrInsertFunction("malloc", I8Ptr, SizeT);
+        FunctionCallee FreeFn = M.getOrInsertFunction("free", B.getVoidTy(), I8Ptr);
+        FunctionCallee Fopen = M.getOrInsertFunction("fopen", I8Ptr, I8Ptr, I8Ptr);
+        FunctionCallee Fread = M.getOrInsertFunction("fread", SizeT, I8Ptr, SizeT, SizeT, I8Ptr);
+        FunctionCallee Fclose = M.getOrInsertFunction("fclose", B.getInt32Ty(), I8Ptr);
+        FunctionCallee Memcmp = M.getOrInsertFunction("memcmp", B.getInt32Ty(), I8Ptr, I8Ptr, SizeT);
+
+        const DataLayout &DL = M.getDataLayout();
+        Type *RecordTy = cast<ArrayType>(Table->getValueType())->getElementType();
+        uint64_t HeaderSize = DL.getTypeAllocSize(Header->getValueType()).getFixedSize();
+        uint64_t Size = HeaderSize + DL.getTypeAllocSize(Table->getValueType()).getFixedSize();
+        // one byte more, to tell a longer file
+        Value *Buf = B.CreateCall(Malloc, {ConstantInt::get(SizeT, Size + 1)});
+        B.CreateCondBr(B.CreateIsNull(Buf), Done, Open);
+
+        B.SetInsertPoint(Open);
+        Value *F = B.CreateCall(Fopen, {Merge->getArg(0), B.CreateGlobalStringPtr("rb")});
+        B.CreateCondBr(B.CreateIsNull(F), Free, Read);
+
+        B.SetInsertPoint(Read);
+        Value *Got = B.CreateCall(Fread, {Buf, ConstantInt::get(SizeT, 1),
+                                          ConstantInt::get(SizeT, Size + 1), F});
+        B.CreateCall(Fclose, {F});
+        B.CreateCondBr(B.CreateICmpEQ(Got, ConstantInt::get(SizeT, Size)), Compare, Free);
+
+        B.SetInsertPoint(Compare);
+        Value *Diff = B.CreateCall(Memcmp, {Buf, B.CreateBitCast(Header, I8Ptr),
+                                            ConstantInt::get(SizeT, HeaderSize)});
+        Value *Records = B.CreateBitCast(B.CreateConstInBoundsGEP1_64(B.getInt8Ty(), Buf, HeaderSize),
+                                         RecordTy->getPointerTo());
+        B.CreateCondBr(B.CreateIsNull(Diff), Check, Free);
+
+        // every id must match before anything is added
+        B.SetInsertPoint(Check);
+        PHINode *I = B.CreatePHI(I64, 2, "i");
+        I->addIncoming(B.getInt64(0), Compare);
+        Value *Id = B.CreateLoad(I64, B.CreateInBoundsGEP(RecordTy, Records,
+                                                          {I, B.getInt32(0)}));
+        Value *Ours = B.CreateLoad(I64, B.CreateInBoundsGEP(Table->getValueType(), Table,
+                                                            {B.getInt64(0), I, B.getInt32(0)}));
+        B.CreateCondBr(B.CreateICmpEQ(Id, Ours), CheckNext, Free);
+
+        B.SetInsertPoint(CheckNext);
+        Value *NextI = B.CreateAdd(I, B.getInt64(1));
+        I->addIncoming(NextI, CheckNext);
+        B.CreateCondBr(B.CreateICmpEQ(NextI, B.getInt64(N)), Add, Check);
+
+        B.SetInsertPoint(Add);
+        PHINode *J = B.CreatePHI(I64, 2, "j");
+        J->addIncoming(B.getInt64(0), CheckNext);
+        for (unsigned Which = 1; Which < 3; ++Which) {
+            Value *From = B.CreateInBoundsGEP(RecordTy, Records, {J, B.getInt32(Which)});
+            Value *To = B.CreateInBoundsGEP(Table->getValueType(), Table,
+                                            {B.getInt64(0), J, B.getInt32(Which)});
+            // threads still running may be adding their counts too
+            B.CreateAtomicRMW(AtomicRMWInst::Add, To, B.CreateLoad(I64, From), MaybeAlign(8),
+                              AtomicOrdering::Monotonic);
+        }
+        Value *NextJ = B.CreateAdd(J, B.getInt64(1));
+        J->addIncoming(NextJ, Add);
+        B.CreateCondBr(B.CreateICmpEQ(NextJ, B.getInt64(N)), Free, Add);
+
+        B.SetInsertPoint(Free);
+        B.CreateCall(FreeFn, {Buf});
+        B.CreateBr(Done);
+
+        B.SetInsertPoint(Done);
+        B.CreateRetVoid();
+    }
+
+    void buildWrite() {
+        Write = define("__cla_prof_write", FunctionType::get(Type::getVoidTy(Ctx), false));
+        BasicBlock *Entry = BasicBlock::Create(Ctx, "entry", Write);
+        BasicBlock *Open = BasicBlock::Create(Ctx, "open", Write);
+        BasicBlock *Done = BasicBlock::Create(Ctx, "done", Write);
+        IRBuilder<> B(Entry);
+        // the exiting thread, in case its own hook has not run
+        B.CreateCall(ThreadExit, {ConstantPointerNull::get(I8Ptr)});
+
+        FunctionCallee Getenv = M.getOrInsertFunction("getenv", I8Ptr, I8Ptr);
+        FunctionCallee Fopen = M.getOrInsertFunction("fopen", I8Ptr, I8Ptr, I8Ptr);
+        FunctionCallee Fwrite = M.getOrInsertFunction("fwrite", SizeT, I8Ptr, SizeT, SizeT, I8Ptr);
+        FunctionCallee Fclose = M.getOrInsertFunction("fclose", B.getInt32Ty(), I8Ptr);
+        Value *Env = B.CreateCall(Getenv, {B.CreateGlobalStringPtr("CLA_PROFILE")});
+        Value *File = B.CreateSelect(B.CreateIsNull(Env), B.CreateGlobalStringPtr(Path), Env);
+        B.CreateCall(Merge, {File});
+        Value *F = B.CreateCall(Fopen, {File, B.CreateGlobalStringPtr("wb")});
+        B.CreateCondBr(B.CreateIsNull(F), Done, Open);
+
+        B.SetInsertPoint(Open);
+        const DataLayout &DL = M.getDataLayout();
+        auto SizeOf = [&](Type *T) {
+            return ConstantInt::get(SizeT, DL.getTypeAllocSize(T).getFixedSize());
+        };
+        Type *RecordTy = cast<ArrayType>(Table->getValueType())->getElementType();
+        B.CreateCall(Fwrite, {B.CreateBitCast(Header, I8Ptr), SizeOf(Header->getValueType()),
+                              ConstantInt::get(SizeT, 1), F});
+        B.CreateCall(Fwrite, {B.CreateBitCast(Table, I8Ptr), SizeOf(RecordTy),
+                              ConstantInt::get(SizeT, N), F});
+        B.CreateCall(Fclose, {F});
+        B.CreateBr(Done);
+
+        B.SetInsertPoint(Done);
+        B.CreateRetVoid();
+    }
+
+    void buildInit() {
+        Function *Init = define("__cla_prof_init", FunctionType::get(Type::getVoidTy(Ctx), false));
+        IRBuilder<> B(BasicBlock::Create(Ctx, "entry", Init));
+        FunctionCallee Atexit = M.getOrInsertFunction("atexit", B.getInt32Ty(), Write->getType());
+        B.CreateCall(Atexit, {Write});
+        B.CreateRetVoid();
+        appendToGlobalCtors(M, Init, 0);
+    }
+
+    Module &M;
+    LLVMContext &Ctx;
+    Type *I64;
+    PointerType *I8Ptr;
+    Type *SizeT;
+    uint64_t N;
+    std::string Path;
+    GlobalVariable *Live, *Table, *Header;
+    Function *ThreadExit, *Register, *Merge, *Write;
+};
+
+unsigned InstrumentLoops(Module &M, const std::string &DefaultPath) {
+    // first the ids, to size the counters; loop info is cheap to redo
+    std::vector<Function *> Functions;
+    std::vector<uint64_t> Ids;
+    for (Function &F : M) {
+        if (F.isDeclaration()) continue;
+        DominatorTree DT(F);
+        LoopInfo LI(DT);
+        size_t Before = Ids.size();
+        for (Loop *L : LI.getLoopsInPreorder()) {
+            if (Optional<uint64_t> Id = AnnotatedLoopId(L, LI)) Ids.push_back(*Id);
+        }
+        if (Ids.size() != Before) Functions.push_back(&F);
+    }
+    if (Ids.empty()) return 0;
+
+    ProfileRuntime Runtime(M, Ids, DefaultPath);
+    unsigned Index = 0;
+    for (Function *F : Functions) {
+        DominatorTree DT(*F);
+        LoopInfo LI(DT);
+        for (Loop *L : LI.getLoopsInPreorder()) {
+            if (!AnnotatedLoopId(L, LI)) continue;
+            BasicBlock *Header = L->getHeader();
+            IRBuilder<> B(&*Header->getFirstInsertionPt());
+            Increment(B, Runtime.Counts, Index, 0, B.getInt64(1));
+
+            SmallVector<BasicBlock *, 4> Latches;
+            L->getLoopLatches(Latches);
+            for (BasicBlock *Latch : Latches)
+                CountBackedge(L, Latch, Index, Runtime.Counts, DT, LI);
+            AddStat(Stat::NumLoopsInstrumented);
+            Index++;
+        }
+        // the entry block is in no loop, so splitting it last is safe
+        Runtime.registerOnEntry(*F);
+    }
+    return Ids.size();
+}
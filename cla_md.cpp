@@ -0,0 +1,120 @@
+// cla-md: list the loops cla annotated in a module, one line per loop:
+//
+//   function  loop-id  file:line  latches  iv-updates  iv  step  memory  trip  count
+//   heat  iterations  entries  est-heat  est-weight
+//
+// Reads the cla entries of the llvm.loop IDs and the cla.iv attachments
+// described in cla_metadata.h, so nothing has to be parsed out of strings.
+
+#include <map>
+
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "cla_metadata.h"
+
+using namespace llvm;
+
+static cl::opt<std::string>
+        InputFilename(cl::Positional, cl::desc("<annotated bitcode>"), cl::init("-"));
+
+struct LoopSummary {
+    CLALoopProperties Props;
+    bool HasID = false;
+    unsigned Latches = 0;
+    unsigned IVUpdates = 0;
+};
+
+int main(int argc, char **argv) {
+    cl::ParseCommandLineOptions(argc, argv, "list the loops annotated by cla\n");
+    llvm_shutdown_obj Y;
+
+    LLVMContext Context;
+    SMDiagnostic Err;
+    std::unique_ptr<Module> M = parseIRFile(InputFilename, Err, Context);
+    if (!M) {
+        Err.print(argv[0], errs());
+        return 1;
+    }
+
+    unsigned IVUpdate = Context.getMDKindID(CLAIVKind);
+    bool Malformed = false;
+    auto Complain = [&](Function &F) {
+        errs() << argv[0] << ": malformed cla metadata in " << F.getName() << "\n";
+        Malformed = true;
+    };
+
+    outs() << "function\tid\tlocation\tlatches\tivupdates\tiv\tstep\tmemory\ttrip\tcount"
+              "\theat\titerations\tentries\test\tweight\n";
+    for (Function &F : *M) {
+        // ordered by line, then ID, so diffs between runs stay readable
+        std::map<std::pair<unsigned, uint64_t>, LoopSummary> Loops;
+        for (BasicBlock &BB : F) {
+            for (Instruction &I : BB) {
+                if (!I.hasMetadataOtherThanDebugLoc()) continue;
+                if (MDNode *ID = I.getMetadata(LLVMContext::MD_loop)) {
+                    bool Bad;
+                    Optional<CLALoopProperties> Props = ReadLoopID(ID, Bad);
+                    if (Bad) Complain(F);
+                    if (Props) {
+                        LoopSummary &S = Loops[{Props->Loop.Line, Props->Loop.Id}];
+                        S.Props = *Props;
+                        S.HasID = true;
+                        S.Latches++;
+                    }
+                }
+                if (MDNode *N = I.getMetadata(IVUpdate)) {
+                    Optional<CLALoopNode> Loop = ReadLoopNode(N);
+                    if (!Loop) {
+                        Complain(F);
+                        continue;
+                    }
+                    LoopSummary &S = Loops[{Loop->Line, Loop->Id}];
+                    if (!S.HasID) S.Props.Loop = *Loop;
+                    S.IVUpdates++;
+                }
+            }
+        }
+
+        auto Field = [](StringRef S) { return S.empty() ? StringRef("-") : S; };
+        for (auto &Entry : Loops) {
+            LoopSummary &S = Entry.second;
+            const CLALoopNode &Loop = S.Props.Loop;
+            outs() << F.getName() << '\t' << format_hex_no_prefix(Loop.Id, 16) << '\t';
+            if (Loop.File)
+                outs() << Loop.File->getFilename() << ':' << Loop.Line;
+            else
+                outs() << '-';
+            outs() << '\t' << S.Latches << '\t' << S.IVUpdates << '\t' << Field(S.Props.IVKind)
+                   << '\t';
+            if (S.Props.IVStep)
+                outs() << *S.Props.IVStep;
+            else
+                outs() << '-';
+            outs() << '\t' << Field(S.Props.Memory) << '\t' << Field(S.Props.TripKind) << '\t';
+            if (S.Props.TripCount)
+                outs() << *S.Props.TripCount;
+            else
+                outs() << '-';
+            outs() << '\t' << Field(S.Props.Heat) << '\t';
+            if (!S.Props.Heat.empty())
+                outs() << S.Props.Iterations << '\t' << S.Props.Entries;
+            else
+                outs() << "-\t-";
+            outs() << '\t' << Field(S.Props.EstimatedHeat) << '\t';
+            if (!S.Props.EstimatedHeat.empty())
+                outs() << S.Props.Weight;
+            else
+                outs() << '-';
+            outs() << '\n';
+        }
+    }
+    return Malformed ? 1 : 0;
+}
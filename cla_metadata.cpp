@@ -0,0 +1,161 @@
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
+
+#include "cla_metadata.h"
+
+using namespace llvm;
+
+const char CLAIVKind[] = "cla.iv";
+
+static Metadata *Int(LLVMContext &Ctx, unsigned Bits, uint64_t V) {
+    return ConstantAsMetadata::get(ConstantInt::get(Type::getIntNTy(Ctx, Bits), V));
+}
+
+static Optional<int64_t> ReadInt(const MDOperand &Op, unsigned Bits) {
+    auto *C = mdconst::dyn_extract_or_null<ConstantInt>(Op);
+    if (!C || C->getBitWidth() != Bits) return None;
+    return C->getSExtValue();
+}
+
+static StringRef ReadString(const MDOperand &Op) {
+    auto *S = dyn_cast_or_null<MDString>(Op.get());
+    return S ? S->getString() : StringRef();
+}
+
+MDNode *GetLoopNode(LLVMContext &Ctx, uint64_t Id, const DILocation *Loc) {
+    Metadata *Name = MDString::get(Ctx, "cla.loop");
+    if (!Loc || !Loc->getFile())
+        return MDNode::get(Ctx, {Name, Int(Ctx, 64, Id)});
+    return MDNode::get(Ctx, {Name, Int(Ctx, 64, Id), Loc->getFile(),
+                             Int(Ctx, 32, Loc->getLine())});
+}
+
+Optional<CLALoopNode> ReadLoopNode(const MDNode *N) {
+    if (!N || (N->getNumOperands() != 2 && N->getNumOperands() != 4) ||
+        ReadString(N->getOperand(0)) != "cla.loop")
+        return None;
+
+    CLALoopNode Node;
+    Optional<int64_t> Id = ReadInt(N->getOperand(1), 64);
+    if (!Id) return None;
+    Node.Id = *Id;
+    if (N->getNumOperands() == 2) return Node;
+
+    Node.File = dyn_cast_or_null<DIFile>(N->getOperand(2).get());
+    Optional<int64_t> Line = ReadInt(N->getOperand(3), 32);
+    if (!Node.File || !Line) return None;
+    Node.Line = *Line;
+    return Node;
+}
+
+MDNode *GetLoopID(LLVMContext &Ctx, MDNode *OrigID, MDNode *Loop, const CLALoopProperties &P) {
+    SmallVector<MDNode *, 4> Props = {Loop};
+    if (!P.IVKind.empty()) {
+        SmallVector<Metadata *, 3> IV = {MDString::get(Ctx, "cla.iv"), MDString::get(Ctx, P.IVKind)};
+        if (P.IVStep) IV.push_back(Int(Ctx, 64, *P.IVStep));
+        Props.push_back(MDNode::get(Ctx, IV));
+    }
+    if (!P.Memory.empty())
+        Props.push_back(MDNode::get(Ctx, {MDString::get(Ctx, "cla.mem"), MDString::get(Ctx, P.Memory)}));
+    if (!P.TripKind.empty()) {
+        SmallVector<Metadata *, 3> Trip = {MDString::get(Ctx, "cla.trip"),
+                                           MDString::get(Ctx, P.TripKind)};
+        if (P.TripCount) Trip.push_back(Int(Ctx, 64, *P.TripCount));
+        Props.push_back(MDNode::get(Ctx, Trip));
+    }
+    if (!P.Heat.empty()) {
+        Metadata *Prof[] = {MDString::get(Ctx, "cla.prof"), MDString::get(Ctx, P.Heat),
+                            Int(Ctx, 64, P.Iterations), Int(Ctx, 64, P.Entries)};
+        Props.push_back(MDNode::get(Ctx, Prof));
+    }
+    if (!P.EstimatedHeat.empty()) {
+        Metadata *Est[] = {MDString::get(Ctx, "cla.est"), MDString::get(Ctx, P.EstimatedHeat),
+                           Int(Ctx, 64, P.Weight)};
+        Props.push_back(MDNode::get(Ctx, Est));
+    }
+
+    // first operand reserved for the self reference
+    SmallVector<Metadata *, 8> Ops = {nullptr};
+    if (OrigID) {
+        for (const MDOperand &Op : drop_begin(OrigID->operands())) {
+            auto *N = dyn_cast_or_null<MDNode>(Op.get());
+            if (N && N->getNumOperands() && ReadString(N->getOperand(0)).startswith("cla."))
+                continue;
+            Ops.push_back(Op);
+        }
+    }
+    Ops.append(Props.begin(), Props.end());
+    MDNode *ID = MDNode::getDistinct(Ctx, Ops);
+    ID->replaceOperandWith(0, ID);
+    return ID;
+}
+
+Optional<CLALoopProperties> ReadLoopID(const MDNode *LoopID, bool &Malformed) {
+    Malformed = false;
+    if (!LoopID || LoopID->getNumOperands() == 0 || LoopID->getOperand(0) != LoopID)
+        return None;
+
+    CLALoopProperties P;
+    bool Found = false, Any = false;
+    for (const MDOperand &Op : drop_begin(LoopID->operands())) {
+        auto *N = dyn_cast_or_null<MDNode>(Op.get());
+        if (!N || N->getNumOperands() == 0) continue;
+        StringRef Name = ReadString(N->getOperand(0));
+        if (!Name.startswith("cla.")) continue;
+        Any = true;
+
+        if (Name == "cla.loop") {
+            Optional<CLALoopNode> Loop = ReadLoopNode(N);
+            // exactly one identity node per loop
+            if (!Loop || Found) Malformed = true;
+            else P.Loop = *Loop;
+            Found = true;
+        } else if (Name == "cla.iv") {
+            unsigned Ops = N->getNumOperands();
+            P.IVKind = Ops >= 2 ? ReadString(N->getOperand(1)) : StringRef();
+            if (Ops == 3) P.IVStep = ReadInt(N->getOperand(2), 64);
+            if (P.IVKind.empty() || Ops > 3 || (Ops == 3 && !P.IVStep)) Malformed = true;
+        } else if (Name == "cla.mem") {
+            P.Memory = N->getNumOperands() == 2 ? ReadString(N->getOperand(1)) : StringRef();
+            if (P.Memory.empty()) Malformed = true;
+        } else if (Name == "cla.trip") {
+            unsigned Ops = N->getNumOperands();
+            P.TripKind = Ops >= 2 ? ReadString(N->getOperand(1)) : StringRef();
+            Optional<int64_t> Count = Ops == 3 ? ReadInt(N->getOperand(2), 64) : None;
+            if (Count) P.TripCount = uint64_t(*Count);
+            // a count is required for "exact", optional for "max"
+            bool CountOK = P.TripKind == "max" || (P.TripKind == "exact") == Count.hasValue();
+            if (P.TripKind.empty() || Ops > 3 || (Ops == 3 && !Count) || !CountOK)
+                Malformed = true;
+        } else if (Name == "cla.prof") {
+            bool Shaped = N->getNumOperands() == 4;
+            P.Heat = Shaped ? ReadString(N->getOperand(1)) : StringRef();
+            Optional<int64_t> Iterations = Shaped ? ReadInt(N->getOperand(2), 64) : None;
+            Optional<int64_t> Entries = Shaped ? ReadInt(N->getOperand(3), 64) : None;
+            if (P.Heat.empty() || !Iterations || !Entries) {
+                Malformed = true;
+                continue;
+            }
+            P.Iterations = *Iterations;
+            P.Entries = *Entries;
+        } else if (Name == "cla.est") {
+            bool Shaped = N->getNumOperands() == 3;
+            P.EstimatedHeat = Shaped ? ReadString(N->getOperand(1)) : StringRef();
+            Optional<int64_t> Weight = Shaped ? ReadInt(N->getOperand(2), 64) : None;
+            if (P.EstimatedHeat.empty() || !Weight) {
+                Malformed = true;
+                continue;
+            }
+            P.Weight = *Weight;
+        }
+    }
+    // properties without the loop they describe
+    if (!Found) {
+        if (Any) Malformed = true;
+        return None;
+    }
+    return P;
+}
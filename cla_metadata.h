@@ -0,0 +1,82 @@
+#ifndef CLA_METADATA_H
+#define CLA_METADATA_H
+
+// The metadata cla attaches to annotated loops, shared by the analysis, its
+// verifier and cla-md. Results live on the loop's llvm.loop ID, next to any
+// hints already there, so they survive the later opt and llc pipelines:
+//
+//   br label %for.cond, !llvm.loop !5                  ; every latch
+//   %inc = add nsw i32 %i, 1, !cla.iv !6               ; the IV update
+//   !5 = distinct !{!5, !9, !6, !7, !8, !10}           ; !9: an existing hint
+//   !6 = !{!"cla.loop", i64 7318..., !1, i32 12}       ; identity
+//   !7 = !{!"cla.iv", !"scev", i64 1}                  ; IV kind, constant step
+//   !8 = !{!"cla.mem", !"readonly"}                    ; memory-access class
+//   !10 = !{!"cla.trip", !"exact", i64 11}             ; trip count
+//   !11 = !{!"cla.prof", !"hot", i64 1100, i64 100}    ; -use-profile
+//   !12 = !{!"cla.est", !"cold", i64 32}               ; -static-hotness
+//
+// The identity is the loop's stable 64-bit ID (see AssignLoopIds in
+// loop_analysis.cpp) plus the DIFile and line of its start (ID only without
+// debug info). It is uniqued, so the IV update and the loop ID share it.
+// cla.iv is left out when no induction variable was found, and so is its
+// step when not constant. cla.trip is "exact" with the count, "max" with a
+// constant bound if there is one, or "unknown". cla.prof is only there for
+// loops found in a -use-profile profile (cla_profile.h): "hot" or "cold",
+// then how often the header ran and how often the loop was entered.
+// cla.est is the same guess made without a profile, by -static-hotness:
+// "hot" or "cold" and the estimated header runs per program run.
+
+#include <cstdint>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace llvm {
+class DIFile;
+class DILocation;
+class LLVMContext;
+class MDNode;
+}
+
+// Instruction attachment naming the loop an IV update belongs to.
+extern const char CLAIVKind[];
+
+struct CLALoopNode {
+    uint64_t Id = 0;
+    const llvm::DIFile *File = nullptr; // null without debug info
+    unsigned Line = 0;
+};
+
+// What cla stores about one loop.
+struct CLALoopProperties {
+    CLALoopNode Loop;
+    llvm::StringRef IVKind;        // "scev", "memory" or empty
+    llvm::Optional<int64_t> IVStep;
+    llvm::StringRef Memory;        // readnone/readonly/writeonly/readwrite/unknown
+    llvm::StringRef TripKind;      // "exact", "max", "unknown" or empty
+    llvm::Optional<uint64_t> TripCount;
+    llvm::StringRef Heat;          // "hot", "cold" or empty without a profile
+    uint64_t Iterations = 0;       // header runs in the profile, with Heat
+    uint64_t Entries = 0;
+    llvm::StringRef EstimatedHeat; // "hot", "cold" or empty without an estimate
+    uint64_t Weight = 0;           // estimated header runs, with EstimatedHeat
+};
+
+// The identity node of loop Id, located at Loc (may be null).
+llvm::MDNode *GetLoopNode(llvm::LLVMContext &Ctx, uint64_t Id, const llvm::DILocation *Loc);
+
+// Decode an identity node; None if N has a different shape.
+llvm::Optional<CLALoopNode> ReadLoopNode(const llvm::MDNode *N);
+
+// A new loop ID holding everything of OrigID (may be null) except earlier
+// cla.* properties, plus P. Loop is the identity node from GetLoopNode.
+llvm::MDNode *GetLoopID(llvm::LLVMContext &Ctx, llvm::MDNode *OrigID, llvm::MDNode *Loop,
+                        const CLALoopProperties &P);
+
+// The cla properties in loop ID LoopID. None if it has no cla.loop entry;
+// Malformed is set if a cla.* entry is there but shaped differently, the
+// cla.loop entry is missing or there is more than one.
+llvm::Optional<CLALoopProperties> ReadLoopID(const llvm::MDNode *LoopID, bool &Malformed);
+
+#endif // CLA_METADATA_H
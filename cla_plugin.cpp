@@ -0,0 +1,144 @@
+// Loadable pass plugin wrapping CustomLoopAnalysis so the annotation runs
+// inside an existing opt invocation instead of a separate cla process.
+//
+// Legacy pass manager:
+//   opt -enable-new-pm=0 -load ./libCLAPlugin.so -cla in.bc -o out.bc
+// New pass manager:
+//   opt -load-pass-plugin ./libCLAPlugin.so -passes=cla in.bc -o out.bc
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Pass.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ToolOutputFile.h"
+
+#include "loop_analysis.h"
+#include "cla_stats.h"
+
+using namespace llvm;
+
+static cl::opt<std::string>
+        CLAStatsFile("cla-stats",
+                     cl::desc("Write the CLA statistics to <file>.stats."),
+                     cl::value_desc("file"),
+                     cl::init(""));
+
+static cl::opt<unsigned>
+        CLAThreads("cla-threads",
+                   cl::desc("Analyze functions on N threads (0 = one per core)."),
+                   cl::value_desc("N"),
+                   cl::init(1));
+
+static cl::opt<std::string>
+        CLALoopRecords("cla-loop-records",
+                       cl::desc("Write one record per loop to <file> (CSV if it ends in "
+                                ".csv, JSON Lines otherwise)."),
+                       cl::value_desc("file"),
+                       cl::init(""));
+
+static cl::opt<std::string>
+        CLACacheDir("cla-cache-dir",
+                    cl::desc("Reuse per-function analysis results stored in <dir>."),
+                    cl::value_desc("dir"),
+                    cl::init(""));
+
+static cl::opt<bool>
+        CLALICM("cla-licm",
+                cl::desc("Hoist loop-invariant code into loop preheaders before annotating."),
+                cl::init(false));
+
+static cl::opt<std::string>
+        CLAUseProfile("cla-use-profile",
+                      cl::desc("Tag loops hot or cold and weight their branches from the "
+                               "loop profile <file>."),
+                      cl::value_desc("file"),
+                      cl::init(""));
+
+static cl::opt<bool>
+        CLAStaticHotness("cla-static-hotness",
+                         cl::desc("Estimate loop hotness from static block and call "
+                                  "frequencies."),
+                         cl::init(false));
+
+static void RunCLA(Module &M) {
+    StatsScope Stats;
+    AnalysisOptions Options;
+    Options.CacheDir = CLACacheDir;
+    Options.Hoist = CLALICM;
+    Options.StaticHotness = CLAStaticHotness;
+
+    CLAProfile Profile;
+    if (!CLAUseProfile.empty()) {
+        std::string Error;
+        if (!ReadProfile(CLAUseProfile, Profile, Error)) report_fatal_error(Twine(Error));
+        Options.Profile = &Profile;
+    }
+
+    std::unique_ptr<ToolOutputFile> Records;
+    if (!CLALoopRecords.empty()) {
+        std::error_code EC;
+        Records.reset(new ToolOutputFile(CLALoopRecords, EC, sys::fs::OF_Text));
+        if (EC)
+            report_fatal_error(Twine(CLALoopRecords) + ": " + EC.message());
+        Options.Records = &Records->os();
+        Options.RecordFormat = StringRef(CLALoopRecords).endswith(".csv")
+                                   ? LoopRecordFormat::CSV
+                                   : LoopRecordFormat::JSONLines;
+        WriteLoopRecordHeader(*Options.Records, Options.RecordFormat);
+    }
+
+    CustomLoopAnalysis(&M, CLAThreads, Options);
+
+    if (Records) Records->keep();
+
+    if (!CLAStatsFile.empty())
+        print_csv_file(CLAStatsFile + ".stats");
+}
+
+namespace {
+
+struct CLALegacyPass : public ModulePass {
+    static char ID;
+    CLALegacyPass() : ModulePass(ID) {}
+
+    bool runOnModule(Module &M) override {
+        RunCLA(M);
+        return true;
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+        // unless hoisting, only metadata (branch weights included) is
+        // attached and the CFG and instructions are untouched
+        if (!CLALICM) AU.setPreservesAll();
+    }
+};
+
+struct CLAPass : public PassInfoMixin<CLAPass> {
+    PreservedAnalyses run(Module &M, ModuleAnalysisManager &) {
+        RunCLA(M);
+        return CLALICM ? PreservedAnalyses::none() : PreservedAnalyses::all();
+    }
+};
+
+} // namespace
+
+char CLALegacyPass::ID = 0;
+static RegisterPass<CLALegacyPass> X("cla", "Custom Loop Analysis", false, false);
+
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+    return {LLVM_PLUGIN_API_VERSION, "CLA", "0.1", [](PassBuilder &PB) {
+        PB.registerPipelineParsingCallback(
+            [](StringRef Name, ModulePassManager &MPM,
+               ArrayRef<PassBuilder::PipelineElement>) {
+                if (Name == "cla") {
+                    MPM.addPass(CLAPass());
+                    return true;
+                }
+                return false;
+            });
+    }};
+}
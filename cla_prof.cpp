@@ -0,0 +1,80 @@
+// cla-prof: read the loop profiles written by `cla -do-profile` programs
+// (cla_profile.h). With -o, the inputs are merged into one profile;
+// otherwise the loops are listed hottest first, one line per loop:
+//
+//   loop-id  entries  iterations  average-trip
+//
+// followed by a histogram of the average trip counts in powers of two.
+// Iterations are header runs, so the trips match cla.trip (cla_metadata.h).
+
+#include <algorithm>
+#include <vector>
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "cla_profile.h"
+
+using namespace llvm;
+
+static cl::list<std::string>
+        InputFilenames(cl::Positional, cl::desc("<profile>..."), cl::OneOrMore);
+
+static cl::opt<std::string>
+        OutputFilename("o", cl::desc("Merge the profiles into <file>."),
+                       cl::value_desc("file"), cl::init(""));
+
+int main(int argc, char **argv) {
+    cl::ParseCommandLineOptions(argc, argv, "read cla loop profiles\n");
+    llvm_shutdown_obj Y;
+
+    CLAProfile Profile;
+    std::string Error;
+    for (const std::string &Input : InputFilenames) {
+        if (!ReadProfile(Input, Profile, Error)) {
+            errs() << argv[0] << ": " << Error << "\n";
+            return 1;
+        }
+    }
+
+    if (!OutputFilename.empty()) {
+        if (!WriteProfile(OutputFilename, Profile, Error)) {
+            errs() << argv[0] << ": " << Error << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    std::vector<std::pair<uint64_t, CLALoopCounts>> Loops(Profile.begin(), Profile.end());
+    std::stable_sort(Loops.begin(), Loops.end(), [](const auto &A, const auto &B) {
+        return A.second.Headers > B.second.Headers;
+    });
+
+    // Buckets[0] for loops never entered, Buckets[k] for trips in [2^(k-1), 2^k)
+    std::vector<unsigned> Buckets(66);
+    outs() << "id\tentries\titerations\ttrip\n";
+    for (auto &Entry : Loops) {
+        const CLALoopCounts &C = Entry.second;
+        outs() << format_hex_no_prefix(Entry.first, 16) << '\t' << C.entries() << '\t'
+               << C.Headers << '\t';
+        if (!C.entries()) {
+            outs() << "-\n";
+            Buckets[0]++;
+            continue;
+        }
+        outs() << format("%.2f", double(C.Headers) / C.entries()) << '\n';
+        Buckets[1 + Log2_64(C.Headers / C.entries())]++;
+    }
+
+    outs() << "\naverage trip\tloops\n";
+    if (Buckets[0]) outs() << "not entered\t" << Buckets[0] << '\n';
+    for (unsigned K = 1; K < Buckets.size(); ++K) {
+        if (!Buckets[K]) continue;
+        uint64_t Low = uint64_t(1) << (K - 1);
+        outs() << '[' << Low << ", " << Low * 2 << ")\t" << Buckets[K] << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <cstring>
+
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "cla_profile.h"
+
+using namespace llvm;
+
+static const char Magic[4] = {'C', 'L', 'A', 'P'};
+static const uint32_t Version = 1;
+static const size_t HeaderSize = 16, RecordSize = 24;
+
+bool ReadProfile(const std::string &Path, CLAProfile &Profile, std::string &Error) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Buf = MemoryBuffer::getFile(Path, false, false);
+    if (!Buf) {
+        Error = Path + ": " + Buf.getError().message();
+        return false;
+    }
+
+    StringRef Data = (*Buf)->getBuffer();
+    const uint8_t *P = Data.bytes_begin();
+    if (Data.size() < HeaderSize || memcmp(P, Magic, 4)) {
+        Error = Path + ": not a cla loop profile";
+        return false;
+    }
+    if (support::endian::read32le(P + 4) != Version) {
+        Error = Path + ": unsupported profile version";
+        return false;
+    }
+    uint64_t Loops = support::endian::read64le(P + 8);
+    if ((Data.size() - HeaderSize) / RecordSize != Loops ||
+        (Data.size() - HeaderSize) % RecordSize) {
+        Error = Path + ": truncated profile";
+        return false;
+    }
+
+    // checked in full first, so a bad file leaves Profile alone
+    for (const uint8_t *R = P + HeaderSize; R != Data.bytes_end(); R += RecordSize) {
+        if (support::endian::read64le(R + 16) > support::endian::read64le(R + 8)) {
+            Error = Path + ": more backedges than header runs";
+            return false;
+        }
+    }
+    for (P += HeaderSize; Loops--; P += RecordSize) {
+        CLALoopCounts &C = Profile[support::endian::read64le(P)];
+        C.Headers += support::endian::read64le(P + 8);
+        C.Backedges += support::endian::read64le(P + 16);
+    }
+    return true;
+}
+
+bool WriteProfile(const std::string &Path, const CLAProfile &Profile, std::string &Error) {
+    std::error_code EC;
+    raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+    if (EC) {
+        Error = Path + ": " + EC.message();
+        return false;
+    }
+
+    char Buf[RecordSize];
+    OS.write(Magic, 4);
+    support::endian::write32le(Buf, Version);
+    support::endian::write64le(Buf + 4, Profile.size());
+    OS.write(Buf, 12);
+    for (auto &Entry : Profile) {
+        support::endian::write64le(Buf, Entry.first);
+        support::endian::write64le(Buf + 8, Entry.second.Headers);
+        support::endian::write64le(Buf + 16, Entry.second.Backedges);
+        OS.write(Buf, RecordSize);
+    }
+    OS.close();
+    if (OS.has_error()) {
+        Error = Path + ": " + OS.error().message();
+        OS.clear_error();
+        return false;
+    }
+    return true;
+}
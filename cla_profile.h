@@ -0,0 +1,47 @@
+#ifndef CLA_PROFILE_H
+#define CLA_PROFILE_H
+
+// Loop profiles, written when a program built from `cla -do-profile` exits.
+// The file is little-endian binary:
+//
+//   char     magic[4] = "CLAP";
+//   uint32_t version = 1;
+//   uint64_t loops;
+//   struct { uint64_t id, headers, backedges; } loop[loops];
+//
+// id is the stable loop id of the cla.loop metadata (cla_metadata.h),
+// headers counts how often the loop header ran and backedges how often the
+// loop went round again, so the loop was entered headers - backedges times.
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace llvm {
+class Module;
+}
+
+struct CLALoopCounts {
+    uint64_t Headers = 0;
+    uint64_t Backedges = 0;
+
+    uint64_t entries() const { return Headers - Backedges; }
+};
+
+// Keyed by loop id, so merged files and listings come out in a stable order.
+typedef std::map<uint64_t, CLALoopCounts> CLAProfile;
+
+// Add the counts in the profile at Path to Profile. On failure Error says
+// why and Profile is unchanged.
+bool ReadProfile(const std::string &Path, CLAProfile &Profile, std::string &Error);
+
+bool WriteProfile(const std::string &Path, const CLAProfile &Profile, std::string &Error);
+
+// Count header runs and taken backedges of every loop cla annotated in M
+// (those with a cla.loop id on their latches) and make the program write
+// them to DefaultPath, or to $CLA_PROFILE if set, when it exits, adding to
+// what an earlier run of the same program left there. Returns the number of
+// loops instrumented; nothing is added to M if that is zero.
+unsigned InstrumentLoops(llvm::Module &M, const std::string &DefaultPath);
+
+#endif // CLA_PROFILE_H
@@ -0,0 +1,69 @@
+#ifndef CLA_PROTOCOL_H
+#define CLA_PROTOCOL_H
+
+// Wire format between `cla -serve` and cla-client over a Unix socket.
+//
+// Every message is a frame: a one byte tag, a 4 byte little-endian payload
+// length and the payload. The client sends its working directory, then one
+// frame per argument, then Run. The server answers with NeedStdin when the
+// request reads "-" (the client replies with one Data frame holding all of
+// its stdin), any number of Stdout/Stderr frames, and finally Exit with the
+// decimal exit code.
+//
+// Kept free of LLVM so the client stays a tiny, fast-starting binary.
+
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+
+namespace claproto {
+
+enum Tag : char {
+    Cwd = 'C',
+    Arg = 'A',
+    Run = 'R',
+    Data = 'D',
+    NeedStdin = 'I',
+    Stdout = 'O',
+    Stderr = 'E',
+    Exit = 'X'
+};
+
+inline bool writeAll(int FD, const char *Buf, size_t Len) {
+    while (Len) {
+        ssize_t N = ::write(FD, Buf, Len);
+        if (N <= 0) return false;
+        Buf += N;
+        Len -= N;
+    }
+    return true;
+}
+
+inline bool readAll(int FD, char *Buf, size_t Len) {
+    while (Len) {
+        ssize_t N = ::read(FD, Buf, Len);
+        if (N <= 0) return false;
+        Buf += N;
+        Len -= N;
+    }
+    return true;
+}
+
+inline bool sendFrame(int FD, Tag T, const std::string &Payload) {
+    uint32_t Len = Payload.size();
+    char Header[5] = {T, char(Len), char(Len >> 8), char(Len >> 16), char(Len >> 24)};
+    return writeAll(FD, Header, sizeof(Header)) && writeAll(FD, Payload.data(), Payload.size());
+}
+
+inline bool recvFrame(int FD, Tag &T, std::string &Payload) {
+    unsigned char Header[5];
+    if (!readAll(FD, reinterpret_cast<char *>(Header), sizeof(Header))) return false;
+    T = Tag(Header[0]);
+    uint32_t Len = Header[1] | Header[2] << 8 | Header[3] << 16 | uint32_t(Header[4]) << 24;
+    Payload.resize(Len);
+    return Len == 0 || readAll(FD, &Payload[0], Len);
+}
+
+} // namespace claproto
+
+#endif // CLA_PROTOCOL_H
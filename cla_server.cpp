@@ -0,0 +1,173 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/CrashRecoveryContext.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "cla_protocol.h"
+#include "cla_server.h"
+#include "cla_stats.h"
+
+using namespace llvm;
+using namespace claproto;
+
+// Point fd Target at a fresh temporary file for the duration of a request.
+class RedirectedFD {
+public:
+    explicit RedirectedFD(int Target) : Target(Target), Tmp(tmpfile()), Saved(dup(Target)) {
+        dup2(fileno(Tmp), Target);
+    }
+
+    ~RedirectedFD() {
+        dup2(Saved, Target);
+        close(Saved);
+        fclose(Tmp);
+    }
+
+    void fill(const std::string &Data) {
+        writeAll(fileno(Tmp), Data.data(), Data.size());
+        lseek(Target, 0, SEEK_SET);
+    }
+
+    std::string contents() {
+        std::string Data;
+        off_t End = lseek(fileno(Tmp), 0, SEEK_END);
+        Data.resize(End);
+        if (End > 0) pread(fileno(Tmp), &Data[0], End, 0);
+        return Data;
+    }
+
+private:
+    int Target;
+    FILE *Tmp;
+    int Saved;
+};
+
+static bool IsProcessOption(StringRef Arg) {
+    // these would exit or re-enter the server instead of running a request
+    Arg = Arg.ltrim('-');
+    return Arg.startswith("help") || Arg == "version" || Arg.startswith("serve");
+}
+
+// A crashed request is unwound without running destructors, so
+// process-wide state can be left pointing into its dead stack frames: the
+// current statistics scope and the -trace profiler. Forget both before and
+// after every request.
+static void ResetRequestState() {
+    StatsScope::resetCurrent();
+    if (timeTraceProfilerEnabled()) timeTraceProfilerCleanup();
+}
+
+static void HandleRequest(int FD, const char *ToolName, const ServerHooks &Hooks) {
+    std::string Cwd;
+    std::vector<std::string> Args;
+    Tag T;
+    std::string Payload;
+    for (;;) {
+        if (!recvFrame(FD, T, Payload)) return;
+        if (T == Run) break;
+        if (T == claproto::Cwd) Cwd = Payload;
+        else if (T == Arg) Args.push_back(Payload);
+        else return;
+    }
+
+    for (const std::string &A : Args) {
+        if (IsProcessOption(A)) {
+            sendFrame(FD, Stderr, std::string(ToolName) + ": " + A + " is not supported through the server\n");
+            sendFrame(FD, Exit, "1");
+            return;
+        }
+    }
+
+    char PrevCwd[4096];
+    if (!getcwd(PrevCwd, sizeof(PrevCwd)) || chdir(Cwd.c_str()) != 0) {
+        sendFrame(FD, Stderr, std::string(ToolName) + ": cannot enter " + Cwd + "\n");
+        sendFrame(FD, Exit, "1");
+        return;
+    }
+
+    int RC = 1;
+    std::string Out, Err;
+    {
+        outs().flush();
+        RedirectedFD StdoutFD(1), StderrFD(2);
+
+        std::vector<const char *> Argv;
+        Argv.push_back(ToolName);
+        for (const std::string &A : Args) Argv.push_back(A.c_str());
+
+        // every request starts from the default option values
+        cl::ResetAllOptionOccurrences();
+        if (cl::ParseCommandLineOptions(Argv.size(), Argv.data(), "", &errs())) {
+            Optional<RedirectedFD> StdinFD;
+            if (Hooks.ReadsStdin()) {
+                if (!sendFrame(FD, NeedStdin, "") || !recvFrame(FD, T, Payload) || T != Data)
+                    Payload.clear();
+                StdinFD.emplace(0);
+                StdinFD->fill(Payload);
+            }
+
+            ResetRequestState();
+            CrashRecoveryContext CRC;
+            if (!CRC.RunSafely([&] { RC = Hooks.Run(); })) {
+                errs() << ToolName << ": request crashed\n";
+                RC = 70;
+            }
+            ResetRequestState();
+        }
+
+        outs().flush();
+        Out = StdoutFD.contents();
+        Err = StderrFD.contents();
+    }
+    if (chdir(PrevCwd) != 0)
+        errs() << ToolName << ": cannot return to " << PrevCwd << "\n";
+
+    if (!Out.empty()) sendFrame(FD, Stdout, Out);
+    if (!Err.empty()) sendFrame(FD, Stderr, Err);
+    sendFrame(FD, Exit, std::to_string(RC));
+}
+
+int RunServer(const std::string &SocketPath, const char *ToolName, const ServerHooks &Hooks) {
+    sockaddr_un Addr;
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sun_family = AF_UNIX;
+    if (SocketPath.size() >= sizeof(Addr.sun_path)) {
+        errs() << ToolName << ": socket path too long: " << SocketPath << "\n";
+        return 1;
+    }
+    strcpy(Addr.sun_path, SocketPath.c_str());
+
+    int Listen = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(SocketPath.c_str());
+    if (Listen < 0 || bind(Listen, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) < 0 ||
+        listen(Listen, 64) < 0) {
+        errs() << ToolName << ": cannot listen on " << SocketPath << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    // a client going away mid-reply must not take the server down
+    signal(SIGPIPE, SIG_IGN);
+    CrashRecoveryContext::Enable();
+
+    errs() << ToolName << ": serving on " << SocketPath << "\n";
+    for (;;) {
+        int FD = accept(Listen, nullptr, nullptr);
+        if (FD < 0) {
+            if (errno == EINTR) continue;
+            errs() << ToolName << ": accept failed: " << strerror(errno) << "\n";
+            return 1;
+        }
+        HandleRequest(FD, ToolName, Hooks);
+        close(FD);
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef CLA_SERVER_H
+#define CLA_SERVER_H
+
+#include <functional>
+#include <string>
+
+struct ServerHooks {
+    // After a request's options are parsed: does it read its input from stdin?
+    std::function<bool()> ReadsStdin;
+    // Run the request as cla would with the parsed options; returns exit code.
+    std::function<int()> Run;
+};
+
+// Answer cla-client requests on the Unix socket SocketPath until killed.
+// Requests are handled one at a time in this process, each under a
+// CrashRecoveryContext: a crash fails that request with exit code 70 and the
+// server keeps going. Work the request hands to long-lived worker threads
+// must recover its crashes there (see RunWorkers in loop_analysis.h).
+int RunServer(const std::string &SocketPath, const char *ToolName, const ServerHooks &Hooks);
+
+#endif // CLA_SERVER_H
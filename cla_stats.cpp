@@ -0,0 +1,111 @@
+#include <atomic>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "cla_stats.h"
+
+using namespace llvm;
+
+static const char *const StatNames[NumStats] = {
+#define CLA_STAT(Name, Desc) #Name,
+#include "cla_stats.def"
+#undef CLA_STAT
+};
+
+static const char *const StatDescriptions[NumStats] = {
+#define CLA_STAT(Name, Desc) Desc,
+#include "cla_stats.def"
+#undef CLA_STAT
+};
+
+const char *StatName(Stat S) {
+    return StatNames[unsigned(S)];
+}
+
+Optional<Stat> LookupStat(StringRef Name) {
+    for (unsigned i = 0; i < NumStats; ++i) {
+        if (Name == StatNames[i]) return Stat(i);
+    }
+    return None;
+}
+
+static std::atomic<uint64_t> NextScopeId(1);
+
+// Set on the main thread before workers start; they only read it.
+static StatsScope *CurrentScope = nullptr;
+
+// The calling thread's shard and the scope it belongs to. Scope ids are
+// never reused, so a stale shard is never mistaken for a live one.
+struct ShardCache {
+    uint64_t ScopeId = 0;
+    uint64_t *Counters = nullptr;
+};
+static thread_local ShardCache Cache;
+
+StatsScope::StatsScope() : Id(NextScopeId++), Previous(CurrentScope) {
+    CurrentScope = this;
+}
+
+StatsScope::~StatsScope() {
+    if (CurrentScope == this) CurrentScope = Previous;
+}
+
+StatsScope &StatsScope::current() {
+    if (CurrentScope) return *CurrentScope;
+    static StatsScope Default;
+    return Default;
+}
+
+void StatsScope::resetCurrent() {
+    CurrentScope = nullptr;
+}
+
+uint64_t *StatsScope::newShard() {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Shards.emplace_back(new Shard());
+    return Shards.back()->data();
+}
+
+void AddStat(Stat S, uint64_t N) {
+    StatsScope &Scope = StatsScope::current();
+    if (Cache.ScopeId != Scope.Id) {
+        Cache.Counters = Scope.newShard();
+        Cache.ScopeId = Scope.Id;
+    }
+    Cache.Counters[unsigned(S)] += N;
+}
+
+uint64_t StatsScope::get(Stat S) const {
+    std::lock_guard<std::mutex> Guard(Lock);
+    uint64_t Total = 0;
+    for (const std::unique_ptr<Shard> &Sh : Shards) Total += (*Sh)[unsigned(S)];
+    return Total;
+}
+
+void StatsScope::writeCSV(raw_ostream &OS) const {
+    for (unsigned i = 0; i < NumStats; ++i) {
+        if (uint64_t Value = get(Stat(i)))
+            OS << StatNames[i] << "," << Value << '\n';
+    }
+}
+
+void StatsScope::print(raw_ostream &OS) const {
+    unsigned Width = 0;
+    for (unsigned i = 0; i < NumStats; ++i) {
+        if (uint64_t Value = get(Stat(i)))
+            Width = std::max<unsigned>(Width, std::to_string(Value).size());
+    }
+    if (!Width) return;
+
+    OS << "===" << std::string(73, '-') << "===\n"
+       << "                          ... Statistics Collected ...\n"
+       << "===" << std::string(73, '-') << "===\n\n";
+    for (unsigned i = 0; i < NumStats; ++i) {
+        if (uint64_t Value = get(Stat(i)))
+            OS << format("%*llu  - %s\n", Width, (unsigned long long)Value, StatDescriptions[i]);
+    }
+    OS << '\n';
+    OS.flush();
+}
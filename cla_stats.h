@@ -0,0 +1,76 @@
+#ifndef CLA_STATS_H
+#define CLA_STATS_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace llvm {
+class raw_ostream;
+}
+
+enum class Stat : unsigned {
+#define CLA_STAT(Name, Desc) Name,
+#include "cla_stats.def"
+#undef CLA_STAT
+};
+
+const unsigned NumStats = 0
+#define CLA_STAT(Name, Desc) + 1
+#include "cla_stats.def"
+#undef CLA_STAT
+    ;
+
+// The .stats key of S, and the statistic with that key.
+const char *StatName(Stat S);
+llvm::Optional<Stat> LookupStat(llvm::StringRef Name);
+
+// Add N to counter S of the current statistics scope. Neither locks nor
+// atomics: every thread counts into a shard of its own, and the shards are
+// only summed when the scope is read.
+void AddStat(Stat S, uint64_t N = 1);
+
+// The statistics of one input module. A scope becomes current for all
+// threads when created and stays so until destroyed, when the previous one
+// is restored; without any scope, counts go to a process-wide default. It
+// must not be read while other threads may still be counting into it.
+class StatsScope {
+public:
+    StatsScope();
+    ~StatsScope();
+    StatsScope(const StatsScope &) = delete;
+    StatsScope &operator=(const StatsScope &) = delete;
+
+    static StatsScope &current();
+
+    // Forget every scope, so counts go to the default again. For callers
+    // that unwound past live scopes without destroying them, like a crashed
+    // cla -serve request.
+    static void resetCurrent();
+
+    uint64_t get(Stat S) const;
+
+    // name,value for every non-zero counter, the .stats format.
+    void writeCSV(llvm::raw_ostream &OS) const;
+
+    // The "Statistics Collected" report -stats prints for llvm::Statistic.
+    void print(llvm::raw_ostream &OS) const;
+
+private:
+    friend void AddStat(Stat S, uint64_t N);
+    typedef std::array<uint64_t, NumStats> Shard;
+
+    uint64_t *newShard();
+
+    const uint64_t Id;
+    StatsScope *Previous;
+    mutable std::mutex Lock;
+    std::vector<std::unique_ptr<Shard>> Shards;
+};
+
+#endif // CLA_STATS_H
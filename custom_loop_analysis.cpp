@@ -4,6 +4,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fstream>
+#include <map>
+#include <thread>
+#include <sys/resource.h>
+#include <sys/wait.h>
 
 #include "llvm-c/Core.h"
 
@@ -14,7 +18,6 @@
 #include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/ADT/StringSet.h"
 #include "llvm/ADT/Twine.h"
-#include "llvm/ADT/Statistic.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ToolOutputFile.h"
@@ -25,6 +28,7 @@
 #include "llvm/LinkAllPasses.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/SystemUtils.h"
 #include "llvm/Analysis/InstructionSimplify.h"
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Transforms/Scalar/IndVarSimplify.h"
@@ -33,21 +37,43 @@
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Dominators.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
 
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "loop_analysis.h"
+#include "cla_stats.h"
+#include "cla_server.h"
+#include "cla_profile.h"
 
 
-using namespace llvm;
 
-static void CustomLoopAnalysis(Module *);
+using namespace llvm;
 
-static void summarize(Module *M);
-static void print_csv_file(std::string outputfile);
+static cl::opt<std::string>
+        InputFilename(cl::Positional, cl::desc("<input bitcode>"), cl::Optional, cl::init("-"));
 
 static cl::opt<std::string>
-        InputFilename(cl::Positional, cl::desc("<input bitcode>"), cl::Required, cl::init("-"));
+        OutputFilename(cl::Positional, cl::desc("<output bitcode>"), cl::Optional, cl::init("out.bc"));
 
 static cl::opt<std::string>
-        OutputFilename(cl::Positional, cl::desc("<output bitcode>"), cl::Required, cl::init("out.bc"));
+        OutputOption("o",
+                     cl::desc("Write the output to <file> (instead of the second positional "
+                              "argument)."),
+                     cl::value_desc("file"),
+                     cl::init(""));
 
 static cl::opt<bool>
         Mem2Reg("mem2reg",
@@ -64,461 +90,940 @@ static cl::opt<bool>
               cl::desc("Do not perform CLA optimization."),
               cl::init(false));
 
+static cl::opt<bool>
+        LICM("licm",
+             cl::desc("Hoist loop-invariant code into loop preheaders before annotating "
+                      "(ignored with -no-licm)."),
+             cl::init(false));
+
 static cl::opt<bool>
         Verbose("verbose",
                     cl::desc("Verbose stats."),
                     cl::init(false));
 
+static cl::opt<unsigned>
+        Threads("j",
+                cl::desc("Analyze functions on N threads (0 = one per core). "
+                         "In batch mode, process N modules at once."),
+                cl::value_desc("N"),
+                cl::init(1));
+
 static cl::opt<bool>
         NoCheck("no",
-                cl::desc("Do not check for valid IR."),
+                cl::desc("Do not check for valid IR (same as -verify=none)."),
                 cl::init(false));
 
-int main(int argc, char **argv) {
-    // Parse command line arguments
-    cl::ParseCommandLineOptions(argc, argv, "llvm system compiler\n");
+enum VerifyKind { VerifyFull, VerifyModified, VerifyNone };
+static cl::opt<VerifyKind>
+        VerifyMode("verify",
+                   cl::desc("How much of the output to check for valid IR:"),
+                   cl::values(clEnumValN(VerifyFull, "full", "The whole module"),
+                              clEnumValN(VerifyModified, "modified",
+                                         "Only functions cla changed, in parallel (default)"),
+                              clEnumValN(VerifyNone, "none", "Nothing")),
+                   cl::init(VerifyModified));
 
-    // Handle creating output files and shutting down properly
-    llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
-    LLVMContext Context;
+static cl::opt<std::string>
+        BatchManifest("batch",
+                      cl::desc("Process every '<input> <output>' pair listed in <manifest>."),
+                      cl::value_desc("manifest"),
+                      cl::init(""));
 
-    // LLVM idiom for constructing output file.
-    std::unique_ptr<ToolOutputFile> Out;
-    std::string ErrorInfo;
-    std::error_code EC;
-    Out.reset(new ToolOutputFile(OutputFilename.c_str(), EC,
-                                 sys::fs::OF_None));
+static cl::opt<std::string>
+        BatchDir("batch-dir",
+                 cl::desc("Process every X.opt.bc below <dir> into X.tune.bc."),
+                 cl::value_desc("dir"),
+                 cl::init(""));
 
-    EnableStatistics();
+static cl::list<std::string>
+        LinkFiles("link",
+                  cl::desc("Link <bitcode> into the input before anything else runs."),
+                  cl::value_desc("bitcode"));
 
-    // Read in module
-    SMDiagnostic Err;
-    std::unique_ptr<Module> M;
-    M = parseIRFile(InputFilename, Err, Context);
+static cl::opt<std::string>
+        Pipeline("passes",
+                 cl::desc("Optimize with this pass pipeline before CLA, e.g. "
+                          "'mem2reg,early-cse,adce' or 'O2'."),
+                 cl::value_desc("pipeline"),
+                 cl::init(""));
 
-    // If errors, fail
-    if (M.get() == 0)
-    {
-        Err.print(argv[0], errs());
-        //FIXME: there is a segmentation fault
-        return 1;
-    }
+static cl::opt<bool>
+        OutputAssembly("S",
+                       cl::desc("Write the annotated module as textual IR (.ll)."),
+                       cl::init(false));
 
-    // If requested, do some early optimizations
-    legacy::PassManager Passes;
-    if (Mem2Reg || CSE){
-	if (Mem2Reg) Passes.add(createPromoteMemoryToRegisterPass());
-	if (CSE){
-	        Passes.add(createEarlyCSEPass());
-            Passes.run(*M.get());
-        }
-    }
+enum EmitKind { EmitBitcode, EmitAssembly, EmitObject };
 
-    //experimental - running IndVarSimplify to get the correct Induction
+static cl::opt<EmitKind>
+        Emit("emit",
+             cl::desc("Kind of output file to write."),
+             cl::values(clEnumValN(EmitBitcode, "bc", "Annotated bitcode (default)"),
+                        clEnumValN(EmitAssembly, "asm", "Native assembly, like llc"),
+                        clEnumValN(EmitObject, "obj", "Native object file")),
+             cl::init(EmitBitcode));
 
-    //Passes.add(createIndVarSimplifyPass());
+static cl::opt<unsigned>
+        CodeGenOptLevel("cg-opt-level",
+                        cl::desc("Code generation optimization level for -emit=asm/obj."),
+                        cl::init(2));
 
-    Passes.add(createPromoteMemoryToRegisterPass());
-    Passes.add(createLoopSimplifyPass());
+static cl::opt<std::string>
+        StatsFile("stats-file",
+                  cl::desc("Write statistics to <file> instead of <output>.stats."),
+                  cl::value_desc("file"),
+                  cl::init(""));
 
-    if (!NoCLA) {
-        CustomLoopAnalysis(M.get());
-    }
+static cl::opt<std::string>
+        Serve("serve",
+              cl::desc("Stay resident and answer cla-client requests on <socket>."),
+              cl::value_desc("socket"),
+              cl::init(""));
 
-    // Collect statistics on Module
-    summarize(M.get());
-    print_csv_file(OutputFilename);
+static cl::opt<bool>
+        Lazy("lazy",
+             cl::desc("Stream the input: materialize, analyze and drop one function "
+                      "at a time. Only statistics are written."),
+             cl::init(false));
 
-    Verbose=1;
-    if (Verbose)
-        PrintStatistics(errs());
+static cl::opt<std::string>
+        LoopRecords("loop-records",
+                    cl::desc("Write one record per loop to <file>: CSV if it ends in .csv, "
+                             "JSON Lines otherwise. In batch mode, <file> is appended "
+                             "to each output name."),
+                    cl::value_desc("file"),
+                    cl::init(""));
 
-    // Verify integrity of Module, do this by default
-    if (!NoCheck)
-    {
-        legacy::PassManager Passes;
-        Passes.add(createVerifierPass());
-        Passes.run(*M.get());
-    }
+static cl::opt<bool>
+        TimePhases("time-phases",
+                   cl::desc("Report the time and peak memory growth of every phase and the "
+                            "slowest functions to analyze; also added to the statistics."),
+                   cl::init(false));
 
-    // Write final bitcode
-    WriteBitcodeToFile(*M.get(), Out->os());
-    Out->keep();
+static cl::opt<std::string>
+        TraceFile("trace",
+                  cl::desc("Write a Chrome trace-event timeline of the run to <file>, one "
+                           "track per thread (batch mode: per module)."),
+                  cl::value_desc("file.json"),
+                  cl::init(""));
 
-    return 0;
-}
+static cl::opt<std::string>
+        CacheDir("cache-dir",
+                 cl::desc("Reuse per-function analysis results stored in <dir> and add "
+                          "new ones."),
+                 cl::value_desc("dir"),
+                 cl::init(""));
 
-static llvm::Statistic nFunctions = {"", "Functions", "number of functions"};
-static llvm::Statistic nInstructions = {"", "Instructions", "number of instructions"};
-static llvm::Statistic nLoads = {"", "Loads", "number of loads"};
-static llvm::Statistic nStores = {"", "Stores", "number of stores"};
+static cl::opt<bool>
+        DoProfile("do-profile",
+                  cl::desc("Instrument the annotated loops to count header runs and taken "
+                           "backedges; the program writes them to -profile-file on exit."),
+                  cl::init(false));
 
-static void summarize(Module *M) {
-    for (auto i = M->begin(); i != M->end(); i++) {
-        if (i->begin() != i->end()) {
-            nFunctions++;
-        }
+static cl::opt<std::string>
+        ProfileFile("profile-file",
+                    cl::desc("Loop profile written by a -do-profile build (default cla.clap; "
+                             "$CLA_PROFILE overrides it at run time)."),
+                    cl::value_desc("file"),
+                    cl::init("cla.clap"));
 
-        for (auto j = i->begin(); j != i->end(); j++) {
-            for (auto k = j->begin(); k != j->end(); k++) {
-                Instruction &I = *k;
-                nInstructions++;
-                if (isa<LoadInst>(&I)) {
-                    nLoads++;
-                } else if (isa<StoreInst>(&I)) {
-                    nStores++;
-                }
-            }
+static cl::opt<bool>
+        UseProfile("use-profile",
+                   cl::desc("Tag loops hot or cold and weight their branches from the "
+                            "-profile-file counts."),
+                   cl::init(false));
+
+static cl::opt<bool>
+        PrintSummary("summary",
+                       cl::desc("With -use-profile, report how many loops the profile "
+                                "matched."),
+                       cl::init(false));
+
+static cl::opt<bool>
+        StaticHotness("static-hotness",
+                      cl::desc("Estimate each loop's header runs per program run from "
+                               "static block and call frequencies, and tag it hot or cold."),
+                      cl::init(false));
+
+// The benchmarks' profile target passes -gcm; cla has no global code motion
+// and hoisting here would change the structural loop ids the profile uses.
+static cl::opt<bool>
+        GCM("gcm", cl::desc("Ignored."), cl::Hidden, cl::init(false));
+
+// Worker threads kept alive across requests by -serve; null otherwise.
+static std::unique_ptr<ThreadPool> ServerPool;
+
+// Parse Input and link every -link module into it, all in Context.
+static std::unique_ptr<Module> LoadModule(const std::string &Input, LLVMContext &Context,
+                                          const char *ToolName) {
+    SMDiagnostic Err;
+    std::unique_ptr<Module> M = parseIRFile(Input, Err, Context);
+    if (!M) {
+        Err.print(ToolName, errs());
+        return nullptr;
+    }
+
+    Linker L(*M);
+    for (const std::string &File : LinkFiles) {
+        std::unique_ptr<Module> Src = parseIRFile(File, Err, Context);
+        if (!Src) {
+            Err.print(ToolName, errs());
+            return nullptr;
+        }
+        if (L.linkInModule(std::move(Src))) {
+            errs() << ToolName << ": cannot link " << File << "\n";
+            return nullptr;
         }
     }
+    return M;
 }
 
-static void print_csv_file(std::string outputfile)
-{
-    std::ofstream stats(outputfile + ".stats");
-    auto a = GetStatistics();
-    for (auto p : a) {
-        stats << p.first.str() << "," << p.second << std::endl;
+// Accept the opt spelling of the standard pipelines (O2) next to the
+// PassBuilder one (default<O2>).
+static std::string ExpandPipeline(StringRef Text) {
+    SmallVector<StringRef, 8> Elements;
+    Text.split(Elements, ',');
+    std::string Expanded;
+    for (StringRef E : Elements) {
+        E = E.trim();
+        if (!Expanded.empty()) Expanded += ",";
+        if (E == "O0" || E == "O1" || E == "O2" || E == "O3" || E == "Os" || E == "Oz")
+            Expanded += ("default<" + E + ">").str();
+        else
+            Expanded += E.str();
     }
-    stats.close();
+    return Expanded;
 }
 
-static llvm::Statistic NumLoops = {"", "NumLoops", "number of loops analyzed"};
-static llvm::Statistic CLANoPreheader = {"", "CLANoPreheader", "absence of preheader prevents optimization"};
-static llvm::Statistic NumLoopsNoStore = {"", "NumLoopsNoStore", "subset of loops that has no Store instructions"};
-static llvm::Statistic NumLoopsNoLoad = {"", "NumLoopsNoLoad", "subset of loops that has no Load instructions"};
-static llvm::Statistic NumLoopsWithCall = {"", "NumLoopsWithCall", "subset of loops that has a call instructions"};
+static bool RunPipeline(Module &M, TargetMachine *TM, const char *ToolName) {
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    PassBuilder PB(TM);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM;
+    if (Error E = PB.parsePassPipeline(MPM, ExpandPipeline(Pipeline))) {
+        errs() << ToolName << ": " << toString(std::move(E)) << "\n";
+        return false;
+    }
+    MPM.run(M, MAM);
+    return true;
+}
 
-static void __addMD(LLVMContext &Ctx, Instruction *I){
-    std::string metadata;
+static std::unique_ptr<TargetMachine> CreateTargetMachine(Module &M, const char *ToolName) {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
 
-    if (DILocation *Loc = I->getDebugLoc()) {
-      unsigned Line = Loc->getLine();
+    Triple TheTriple(M.getTargetTriple());
+    if (TheTriple.getTriple().empty())
+        TheTriple.setTriple(sys::getDefaultTargetTriple());
 
-      StringRef File = Loc->getFilename();
-      metadata = formatv("{0}:{1}", File.str(), Line);
+    std::string Error;
+    const Target *TheTarget = TargetRegistry::lookupTarget(TheTriple.getTriple(), Error);
+    if (!TheTarget) {
+        errs() << ToolName << ": " << Error << "\n";
+        return nullptr;
+    }
 
-      MDNode* N = MDNode::get(Ctx, MDString::get(Ctx, "canonical_ind_var"));
-      I->setMetadata("IndVarUpdateInst:", N);
+    CodeGenOpt::Level OLvl = CodeGenOpt::Default;
+    switch (CodeGenOptLevel) {
+    case 0: OLvl = CodeGenOpt::None; break;
+    case 1: OLvl = CodeGenOpt::Less; break;
+    case 2: OLvl = CodeGenOpt::Default; break;
+    default: OLvl = CodeGenOpt::Aggressive; break;
     }
+
+    TargetOptions Options;
+    std::unique_ptr<TargetMachine> TM(TheTarget->createTargetMachine(
+        TheTriple.getTriple(), "", "", Options, None, None, OLvl));
+    M.setDataLayout(TM->createDataLayout());
+    return TM;
 }
 
+static bool EmitNative(Module &M, TargetMachine &TM, raw_pwrite_stream &OS, const char *ToolName) {
+    legacy::PassManager CG;
+    CG.add(new TargetLibraryInfoWrapperPass(Triple(M.getTargetTriple())));
+    CodeGenFileType FileType = Emit == EmitObject ? CGFT_ObjectFile : CGFT_AssemblyFile;
+    if (TM.addPassesToEmitFile(CG, OS, nullptr, FileType)) {
+        errs() << ToolName << ": target does not support this file type\n";
+        return false;
+    }
+    CG.run(M);
+    return true;
+}
 
-static bool CollectInductionVariables(Loop *L, PredicatedScalarEvolution *PSE){
-    BasicBlock *LoopHeader = L->getHeader();
+enum Phase { LoadPhase, PipelinePhase, PrePassPhase, AnalysisPhase, VerifyPhase, WritePhase,
+             NumPhases };
 
-    for (BasicBlock::iterator I = LoopHeader->begin(); I != LoopHeader->end(); ++I) {
-        Instruction &i = *I;
-        if (i.isBinaryOp()){
-            const SCEV *se = PSE->getSCEV(i.getOperand(0));
-        }
-    }
+static const char *const PhaseNames[NumPhases] = {
+    "Load", "Pipeline", "PrePasses", "Analysis", "Verify", "Write"};
 
-    /*
+static const char *const PhaseDescriptions[NumPhases] = {
+    "Parse and link", "Pass pipeline (-passes)", "Pre-passes (-mem2reg, -cse)",
+    "Loop analysis and summary", "Verifier", "Write output"};
 
-      BasicBlock *H = L->getHeader(); 
-      BasicBlock *Incoming = nullptr, *Backedge = nullptr;
-      pred_iterator PI = pred_begin(H);
-      assert(PI != pred_end(H) && "Loop must have at least one backedge!");
-      Backedge = *PI++;
-      if (PI == pred_end(H))
-        errs() << "dead loop\n" ;
-        return false; // dead loop
-      Incoming = *PI++;
-      if (PI != pred_end(H))
-        errs() << "multiple backedges\n";
-        return false;
+static long PeakRSSKB() {
+    struct rusage Usage;
+    getrusage(RUSAGE_SELF, &Usage);
+    return Usage.ru_maxrss;
+}
 
-      // Loop over all of the PHI nodes, looking for a canonical indvar.
-      SmallVector<Instruction *, 16> Worklist; 
-      for (BasicBlock::iterator I = H->begin(); isa<PHINode>(I); ++I) {
-        PHINode *PN = cast<PHINode>(I);
-
-        if (ConstantInt *CI = dyn_cast<ConstantInt>(PN->getIncomingValueForBlock(Incoming))){
-            if (Instruction *Inc = dyn_cast<Instruction>(PN->getIncomingValueForBlock(Backedge))){
-              if (Inc->isBinaryOp()){
-                    Worklist.push_back(PN);
-                    errs() << "potential induction var" << PN << "\n";
-              }
-           }
-        }
-      }
-    */
-      
-      return false;
+static bool InBatch() {
+    return !BatchManifest.empty() || !BatchDir.empty();
 }
 
-static void getLoopExitBlocks(Loop *L, SmallVector<BasicBlock*, 16> &ExitingBBs){
-    L->getExitingBlocks(ExitingBBs);
+// Where a batch child with process id Pid leaves its part of the trace.
+static std::string ChildTracePath(int Pid) {
+    return TraceFile + "." + std::to_string(Pid);
+}
 
-    for (auto it = ExitingBBs.begin(); it != ExitingBBs.end();) {
-        auto *BI = dyn_cast<BranchInst>((*it)->getTerminator());
-        if (!BI || (!BI->isConditional())){
-            it = ExitingBBs.erase(it);
-       
-        } else {
-            // If the item meets the criteria, move to the next item
-            errs() << "considering exit block " << (*it) << "\n";
-            ++it;
+// -trace for one module. The trace profiler is per thread: analysis workers
+// start their own and hand it back when done (see CustomLoopAnalysis).
+class TraceSession {
+public:
+    TraceSession() {
+        if (!TraceFile.empty()) timeTraceProfilerInitialize(0, "cla");
+    }
+
+    ~TraceSession() {
+        if (timeTraceProfilerEnabled()) timeTraceProfilerCleanup();
+    }
+
+    bool write(const char *ToolName) {
+        if (!timeTraceProfilerEnabled()) return true;
+        std::string Path = InBatch() ? ChildTracePath(getpid()) : TraceFile;
+        if (Error E = timeTraceProfilerWrite(Path, Path)) {
+            errs() << ToolName << ": " << toString(std::move(E)) << "\n";
+            return false;
         }
+        return true;
+    }
+};
+
+// -time-phases bookkeeping for one module: an llvm::Timer per phase and how
+// much the peak RSS grew while each phase ran. Does nothing unless enabled.
+class PhaseTimers {
+public:
+    PhaseTimers() : Clocks(new PhaseClocks()) {
+        for (unsigned P = 0; P < NumPhases; ++P)
+            Clocks->Timers[P].init(PhaseNames[P], PhaseDescriptions[P], Clocks->Group);
     }
 
-    return;
+    // Where the analysis leaves its per-function times, if they are wanted.
+    std::vector<std::pair<std::string, double>> *functionTimes() {
+        return TimePhases ? &Functions : nullptr;
+    }
 
-    /*
-    BasicBlock *ExitingBB = nullptr;
-    for (auto *ExitingBB: ExitingBBs){
-        errs() << "Considering Exiting BB " << ExitingBB << "\n";    
-        auto *BI = dyn_cast<BranchInst>(ExitingBB->getTerminator());
-        if (!BI)
-            Changed = true;
-            continue;
-        assert(BI->isConditional() && "exit branch must be conditional");
+    void start(Phase P) {
+        if (timeTraceProfilerEnabled()) timeTraceProfilerBegin(PhaseNames[P], "");
+        if (!TimePhases) return;
+        RSSAtStart = PeakRSSKB();
+        Clocks->Timers[P].startTimer();
+    }
 
-        auto *ICmp = dyn_cast<ICmpInst>(BI->getCondition());
-        if (!ICmp || !ICmp->hasOneUse())
-            Changed = true;
-            continue;
+    void stop(Phase P) {
+        if (timeTraceProfilerEnabled()) timeTraceProfilerEnd();
+        if (!TimePhases) return;
+        Clocks->Timers[P].stopTimer();
+        RSSGrowth[P] += PeakRSSKB() - RSSAtStart;
+    }
 
-        auto *LHS = ICmp->getOperand(0);
-        auto *RHS = ICmp->getOperand(1);
-        // For the range reasoning, avoid computing SCEVs in the loop to avoid
-        // poisoning cache with sub-optimal results.  For the must-execute case,
-        // this is a neccessary precondition for correctness.
-        if (!L->isLoopInvariant(RHS)) {
-          if (!L->isLoopInvariant(LHS))
-            Changed = true;
-            continue;
-          // Same logic applies for the inverse case
-          std::swap(LHS, RHS);
+    // Print the report to stderr and append the numbers to StatsPath (if
+    // any), in the name,value form of the statistics.
+    void report(const std::string &StatsPath) {
+        if (!TimePhases) return;
+
+        if (!StatsPath.empty()) {
+            std::error_code EC;
+            raw_fd_ostream Stats(StatsPath, EC, sys::fs::OF_Append | sys::fs::OF_Text);
+            for (unsigned P = 0; P < NumPhases; ++P) {
+                if (!Clocks->Timers[P].hasTriggered()) continue;
+                TimeRecord T = Clocks->Timers[P].getTotalTime();
+                Stats << "Time" << PhaseNames[P] << "WallUs," << uint64_t(T.getWallTime() * 1e6) << '\n'
+                      << "Time" << PhaseNames[P] << "UserUs," << uint64_t(T.getUserTime() * 1e6) << '\n'
+                      << "PeakRSS" << PhaseNames[P] << "KB," << RSSGrowth[P] << '\n';
+            }
+            Stats << "PeakRSSKB," << PeakRSSKB() << '\n';
         }
 
-        ExitingBBs.push_back(ExitingBB);
+        Clocks->Group.print(errs());
+        errs() << "  Peak RSS growth per phase:\n";
+        for (unsigned P = 0; P < NumPhases; ++P) {
+            if (Clocks->Timers[P].hasTriggered())
+                errs() << formatv("    {0,-12} {1,10} KB\n", PhaseNames[P], RSSGrowth[P]);
+        }
+        errs() << formatv("    {0,-12} {1,10} KB\n\n", "Peak RSS", PeakRSSKB());
+        // already reported, keep the timers from printing again on destruction
+        Clocks->Group.clear();
+
+        size_t Shown = std::min<size_t>(Functions.size(), 10);
+        std::partial_sort(Functions.begin(), Functions.begin() + Shown, Functions.end(),
+                          [](const std::pair<std::string, double> &A,
+                             const std::pair<std::string, double> &B) {
+                              return A.second > B.second;
+                          });
+        errs() << "  Slowest functions to analyze (of " << Functions.size() << "):\n";
+        for (size_t i = 0; i < Shown; ++i)
+            errs() << formatv("    {0,10:f6}s  {1}\n", Functions[i].second, Functions[i].first);
     }
-    */
 
-}
-
-static bool isAnExitBlock(BasicBlock *BB, SmallVector<BasicBlock *, 16> &ExitBlocks) {
-    for (auto it = ExitBlocks.begin(); it != ExitBlocks.end(); ++it) {
-        if (BB == *it) {
-            return true;
+private:
+    // On the heap: LLVM links every timer group into a global list, and a
+    // crashed -serve request must leak its timers rather than leave that
+    // list pointing into a dead stack frame.
+    struct PhaseClocks {
+        TimerGroup Group{"cla", "cla phase timing"};
+        Timer Timers[NumPhases];
+    };
+    std::unique_ptr<PhaseClocks> Clocks;
+    long RSSGrowth[NumPhases] = {};
+    long RSSAtStart = 0;
+    std::vector<std::pair<std::string, double>> Functions;
+};
+
+// Times the enclosing scope as phase P.
+class PhaseScope {
+public:
+    PhaseScope(PhaseTimers &Timers, Phase P) : Timers(Timers), P(P) { Timers.start(P); }
+    ~PhaseScope() { Timers.stop(P); }
+
+private:
+    PhaseTimers &Timers;
+    Phase P;
+};
+
+// The -loop-records file of one module.
+class LoopRecordFile {
+public:
+    // Open the file and point Options at it.
+    bool open(const std::string &Output, const char *ToolName, AnalysisOptions &Options) {
+        if (LoopRecords.empty()) return true;
+
+        std::string Path = LoopRecords;
+        if (InBatch()) Path = Output + Path;
+
+        std::error_code EC;
+        Out.reset(new ToolOutputFile(Path, EC, sys::fs::OF_Text));
+        if (EC) {
+            errs() << ToolName << ": " << Path << ": " << EC.message() << "\n";
+            return false;
         }
+        Options.Records = &Out->os();
+        Options.RecordFormat = StringRef(Path).endswith(".csv") ? LoopRecordFormat::CSV
+                                                                : LoopRecordFormat::JSONLines;
+        WriteLoopRecordHeader(*Options.Records, Options.RecordFormat);
+        return true;
     }
-    return false;
+
+    void keep() {
+        if (Out) Out->keep();
+    }
+
+private:
+    std::unique_ptr<ToolOutputFile> Out;
+};
+
+// Only cla's own metadata is new in functions the analysis did not touch,
+// and those were verified by whoever wrote the input, so -verify=modified
+// checks just the touched ones. Anything that rewrote bodies on the way in
+// (-link, -passes, -mem2reg, -cse, -do-profile) leaves every function to
+// check.
+static VerifyKind EffectiveVerifyMode() {
+    if (NoCheck) return VerifyNone;
+    if (VerifyMode == VerifyModified &&
+        (!LinkFiles.empty() || !Pipeline.empty() || Mem2Reg || CSE || DoProfile))
+        return VerifyFull;
+    return VerifyMode;
 }
 
-static bool CompareInstDeterminesLoopExitCondition(Instruction *I, Loop *L, SmallVector<BasicBlock*, 16> &ExitBlocks){
-    // go through all the exit blocks and see if the compare instruction
-    // determines the exits. Some exiting BB's won't be eligible 
-    if (I->use_empty()) return false;
+// verifyFunction over Fns on Threads threads (0 = one per core), plus the
+// shape of cla's metadata. Diagnostics are printed in module order.
+static bool VerifyFunctions(const std::vector<Function *> &Fns, unsigned Threads,
+                            const std::string &Input, const char *ToolName) {
+    std::vector<std::string> Errors(Fns.size());
+    std::vector<char> Broken(Fns.size());
+    auto Check = [&](size_t i) {
+        raw_string_ostream OS(Errors[i]);
+        Broken[i] = verifyFunction(*Fns[i], &OS);
+    };
+
+    if (Threads == 1 || Fns.size() < 2) {
+        for (size_t i = 0; i < Fns.size(); ++i) Check(i);
+    } else {
+        // the verifier only reads the IR, so functions can be checked side by side
+        ThreadPoolStrategy Strategy = hardware_concurrency(Threads);
+        Optional<ThreadPool> OwnPool;
+        if (!ServerPool) OwnPool.emplace(Strategy);
+        ThreadPool &Pool = ServerPool ? *ServerPool : *OwnPool;
+        unsigned NumWorkers = std::min<size_t>(
+            std::min(Strategy.compute_thread_count(), Pool.getThreadCount()), Fns.size());
+        std::atomic<size_t> Next(0);
+        RunWorkers(Pool, NumWorkers, [&](unsigned) {
+            for (size_t i = Next++; i < Fns.size(); i = Next++) Check(i);
+        });
+    }
 
-   for (User *U : I->users()) {
-        if (Instruction *UserInst = dyn_cast<Instruction>(U)) {
-            // Check if the user instruction is in the loop's exit blocks
-            if (isAnExitBlock(UserInst->getParent(), ExitBlocks)) {
-                errs() << "Use: " << *UserInst << "\n";
-            }
-        }
+    bool Failed = false;
+    for (size_t i = 0; i < Fns.size(); ++i) {
+        if (!Broken[i]) continue;
+        errs() << Errors[i];
+        errs() << ToolName << ": " << Input << ": invalid function " << Fns[i]->getName() << "\n";
+        Failed = true;
     }
+    if (VerifyAnnotations(Fns, errs())) {
+        errs() << ToolName << ": " << Input << ": malformed cla metadata\n";
+        Failed = true;
+    }
+    return !Failed;
+}
 
+// Read -profile-file into Profile and point Options at it.
+static bool LoadLoopProfile(CLAProfile &Profile, AnalysisOptions &Options, const char *ToolName) {
+    if (!UseProfile) return true;
+    std::string Error;
+    if (!ReadProfile(ProfileFile, Profile, Error)) {
+        errs() << ToolName << ": " << Error << "\n";
+        return false;
+    }
+    Options.Profile = &Profile;
     return true;
 }
 
-static bool isInductionVariableUpdate(LLVMContext &Ctx, Instruction* I, Loop *L){
-    //it is a binary op 
-    //it is either Add, Sub
-    // is a canonical induction update
-    errs() << "isInductionVariable " << *I << "\n";
-    Value *op0, *op1;
-    
-    Instruction *desired = nullptr;
-    if (I->getOpcode() == Instruction::Add) {
-        op0 = I->getOperand(0);
-        op1 = I->getOperand(1);
-
-        errs() << "found an add " << I << "\n";
-        if (L->isLoopInvariant(op0) || L->isLoopInvariant(op1)){
-            errs() << "Found the instruction! " << *I << "\n";
-            desired = I;
-        }
+static void PrintProfileSummary(const StatsScope &Stats, const std::string &Input) {
+    if (!UseProfile || !PrintSummary) return;
+    errs() << Input << ": " << Stats.get(Stat::NumHotLoops) << " hot and "
+           << Stats.get(Stat::NumColdLoops) << " cold loops in " << ProfileFile << ", "
+           << Stats.get(Stat::NumLoopsNotProfiled) << " not profiled, "
+           << Stats.get(Stat::NumBranchesWeighted) << " branches weighted\n";
+}
+
+// The analysis settings every module gets from the parsed options.
+static AnalysisOptions ParsedAnalysisOptions(PhaseTimers &Phases) {
+    AnalysisOptions Options;
+    Options.CacheDir = CacheDir;
+    Options.Hoist = LICM;
+    Options.FunctionTimes = Phases.functionTimes();
+    Options.Pool = ServerPool.get();
+    return Options;
+}
+
+// -stats-file, else <output>.stats; nothing when the output is stdout.
+static std::string StatsPathFor(const std::string &Output) {
+    if (!StatsFile.empty()) return StatsFile;
+    return Output == "-" ? "" : Output + ".stats";
+}
 
+// Link, optimize, analyze and (optionally) generate code for one module
+// without leaving Context: the intermediate .link/.opt/.tune bitcode of the
+// file-per-stage flow is never written or re-parsed.
+static int ProcessModule(const std::string &Input, const std::string &Output,
+                         const char *ToolName, unsigned AnalysisThreads) {
+    LLVMContext Context;
+
+    // LLVM idiom for constructing output file.
+    std::unique_ptr<ToolOutputFile> Out;
+    std::string ErrorInfo;
+    std::error_code EC;
+    bool TextOutput = OutputAssembly || Emit == EmitAssembly;
+    Out.reset(new ToolOutputFile(Output.c_str(), EC,
+                                 TextOutput ? sys::fs::OF_Text : sys::fs::OF_None));
+    if (EC) {
+        errs() << ToolName << ": " << Output << ": " << EC.message() << "\n";
+        return 1;
     }
-    else if (I->getOpcode() == Instruction::Sub){
-       errs() << "found an Sub" << I << "\n";
-        return false;
+    if (!TextOutput && CheckBitcodeOutputToConsole(Out->os()))
+        return 1;
+
+    StatsScope Stats;
+    TraceSession Trace;
+    PhaseTimers Phases;
+    AnalysisOptions Options = ParsedAnalysisOptions(Phases);
+    Options.StaticHotness = StaticHotness;
+    CLAProfile Profile;
+    if (!LoadLoopProfile(Profile, Options, ToolName)) return 1;
+
+    // Read in module
+    std::unique_ptr<Module> M;
+    {
+        PhaseScope Timed(Phases, LoadPhase);
+        M = LoadModule(Input, Context, ToolName);
     }
-    else if (I->getOpcode() == Instruction::Mul){
-       errs() << "found an Mul" << I << "\n";
-        return false;
+
+    // If errors, fail
+    if (M.get() == 0)
+    {
+        return 1;
     }
 
-    else if (I->getOpcode() == Instruction::Alloca){
-        errs() << "Considering an Alloca instruction\n"; 
-        //see if this alloca is used as an induction variable
-        if (I->use_empty()) return false;
-        /*
-        for (Value *au : I->uses()){
-            Instruction *aui = dyn_cast_or_null<Instruction>(au);
-            errs() << "Use of alloca " << *aui << "\n";
-            if (aui->getOpcode() != Instruction::Alloca){
-                if (isInductionVariableUpdate(Ctx, aui, L)) {
-                    desired = aui;
-                    break;
-                }
-            }
-        }
-        */
+    std::unique_ptr<TargetMachine> TM;
+    if (Emit != EmitBitcode) {
+        TM = CreateTargetMachine(*M, ToolName);
+        if (!TM) return 1;
     }
 
-    else if (I->getOpcode() == Instruction::Load){
-        errs() << "Considering a Load instruction\n"; 
-        if (LoadInst *L = dyn_cast<LoadInst>(I)){
-            if (L->isVolatile()) return false;
-        }
+    if (!Pipeline.empty()) {
+        PhaseScope Timed(Phases, PipelinePhase);
+        if (!RunPipeline(*M, TM.get(), ToolName))
+            return 1;
+    }
+
+    // If requested, do some early optimizations. Neither is needed for the
+    // analysis: memory-resident induction variables are found with MemorySSA.
+    if (Mem2Reg || CSE){
+        PhaseScope Timed(Phases, PrePassPhase);
+        legacy::PassManager Passes;
+        if (Mem2Reg) Passes.add(createPromoteMemoryToRegisterPass());
+        if (CSE) Passes.add(createEarlyCSEPass());
+        Passes.run(*M.get());
+    }
 
+    LoopRecordFile Records;
+    if (!Records.open(Output, ToolName, Options)) return 1;
 
-        if (GlobalVariable *globalVar = dyn_cast<GlobalVariable>(I->getOperand(0))) {
-//            if (!globalVar->hasDefinitiveInitializer()){
-                return false;
-//            }
+    VerifyKind Verify = EffectiveVerifyMode();
+    std::vector<Function *> Modified;
+    if (Verify == VerifyModified) Options.Modified = &Modified;
+
+    // Collect statistics on Module, annotating it in the same walk
+    {
+        PhaseScope Timed(Phases, AnalysisPhase);
+        if (!NoCLA) {
+            CustomLoopAnalysis(M.get(), AnalysisThreads, Options);
+        } else {
+            summarize(M.get());
         }
+        // after the analysis, so the counters stay out of its numbers
+        if (DoProfile) InstrumentLoops(*M, ProfileFile);
+    }
+    PrintProfileSummary(Stats, Input);
+    std::string StatsPath = StatsPathFor(Output);
+    if (!StatsPath.empty()) print_csv_file(StatsPath);
 
-        Instruction *LoadPointerOperand = dyn_cast_or_null<Instruction>(I->getOperand(0));
-        if (LoadPointerOperand->use_empty()) return false;
-
-        for (User *U : LoadPointerOperand->users()) {
-            errs() <<"===considering load's usage " << U <<"\n";
-            if (StoreInst *Store = dyn_cast_or_null<StoreInst>(U)) {
-                Value *StorePointerOperand = Store->getPointerOperand();
-                if (LoadPointerOperand == StorePointerOperand) {
-                    errs() << "Found a Load and Store accessing the same memory address " << *Store << "\n";
-                        //what are you storing? 
-                        Value *StoreValueOp = Store->getValueOperand();
-                        if (Instruction *StoreValue = dyn_cast_or_null<Instruction>(StoreValueOp)){
-                            if (isInductionVariableUpdate(Ctx, StoreValue, L)){
-                                desired = StoreValue;         
-                                break;
-                            }
-                        }    
-                    }
-                }
-            }
+    Verbose=1;
+    if (Verbose)
+        Stats.print(errs());
+
+    // Verify integrity of Module, do this by default
+    if (Verify == VerifyFull)
+    {
+        PhaseScope Timed(Phases, VerifyPhase);
+        legacy::PassManager Passes;
+        Passes.add(createVerifierPass());
+        Passes.run(*M.get());
+
+        std::vector<Function *> Defined;
+        for (Function &F : *M)
+            if (!F.isDeclaration()) Defined.push_back(&F);
+        if (VerifyAnnotations(Defined, errs())) {
+            errs() << ToolName << ": " << Input << ": malformed cla metadata\n";
+            return 1;
         }
-    if (desired){
-        __addMD(Ctx, desired);
-        return true;
-    } 
-    return false;
+    }
+    else if (Verify == VerifyModified)
+    {
+        PhaseScope Timed(Phases, VerifyPhase);
+        if (!VerifyFunctions(Modified, AnalysisThreads, Input, ToolName))
+            return 1;
+    }
 
+    // Write final bitcode, or hand the module straight to the code generator
+    {
+        PhaseScope Timed(Phases, WritePhase);
+        if (Emit == EmitBitcode && OutputAssembly)
+            M->print(Out->os(), nullptr);
+        else if (Emit == EmitBitcode)
+            WriteBitcodeToFile(*M.get(), Out->os());
+        else if (!EmitNative(*M, *TM, Out->os(), ToolName))
+            return 1;
+        Out->os().flush();
+    }
+    Phases.report(StatsPath);
+    if (!Trace.write(ToolName)) return 1;
+    Out->keep();
+    Records.keep();
+
+    return 0;
 }
 
-static void FindIndVarUpdateCandidates(LLVMContext &Ctx, Loop *L, SmallVector<BasicBlock*, 16> &ExitBlocks){
-    BasicBlock *LoopLatch = L->getLoopLatch();
-    BasicBlock *LoopHeader = L->getHeader();
-
-    //go through all the instructions in the header
-    //the terminating condition will contain a use of an update
-    
-    SmallVector<Instruction *, 16> NonConstOps; 
-    for (BasicBlock::iterator I = LoopHeader->begin(); I != LoopHeader->end(); ++I){
-        Instruction &i = *I;
-
-        if (isa<CmpInst>(i) && CompareInstDeterminesLoopExitCondition(&i, L, ExitBlocks)){ // AND it determines loop exit
-            Value *LatchCmpOp0 = i.getOperand(0);
-            Instruction *i0 = dyn_cast_or_null<Instruction>(LatchCmpOp0);
-
-            if (i0){
-                if (!isa<Constant>(i0)){
-                    if (L->contains(i0->getParent())){
-                        NonConstOps.push_back(i0);
-                    }
-                }
-            }
+// -lazy: peak memory follows the largest function instead of the whole
+// module. Bodies are dropped after analysis, so no bitcode can be written;
+// Output only names the statistics file.
+static int ProcessModuleLazy(const std::string &Input, const std::string &Output,
+                             const char *ToolName) {
+    if (!LinkFiles.empty() || !Pipeline.empty() || Mem2Reg || CSE || Emit != EmitBitcode ||
+        OutputAssembly || DoProfile || StaticHotness) {
+        errs() << ToolName << ": -lazy cannot be combined with -link, -passes, "
+                              "-mem2reg, -cse, -emit, -S, -do-profile or -static-hotness\n";
+        return 1;
+    }
 
-            Value *LatchCmpOp1 = i.getOperand(1);
-            Instruction *i1 = dyn_cast_or_null<Instruction>(LatchCmpOp1);
+    LLVMContext Context;
+    StatsScope Stats;
+    TraceSession Trace;
+    PhaseTimers Phases;
+    AnalysisOptions Options = ParsedAnalysisOptions(Phases);
+    CLAProfile Profile;
+    if (!LoadLoopProfile(Profile, Options, ToolName)) return 1;
 
-            if (i1){
-                if (!isa<Constant>(i1)){
-                    if (L->contains(i1->getParent())){
-                        NonConstOps.push_back(i1);
-                    }
-                }
-            } 
-        }
+    SMDiagnostic Err;
+    Phases.start(LoadPhase);
+    std::unique_ptr<Module> M = getLazyIRFileModule(Input, Err, Context);
+    Phases.stop(LoadPhase);
+    if (!M) {
+        Err.print(ToolName, errs());
+        return 1;
     }
 
-    if (NonConstOps.empty()){
-        errs() << "FOUND NO UPDATE VAR\n";
-    } else {
-        errs() << "found some instruction to consider as ind var\n";
-    }
+    LoopRecordFile Records;
+    if (!Records.open(Output, ToolName, Options)) return 1;
+
+    VerifyKind Verify = EffectiveVerifyMode();
+    std::vector<Function *> Modified;
+    if (Verify == VerifyModified) Options.Modified = &Modified;
+
+    // materializing a body counts as loading it
+    FunctionStreamAnalysis Stream(Options);
+    for (Function &F : *M) {
+        Phases.start(LoadPhase);
+        Error E = F.materialize();
+        Phases.stop(LoadPhase);
+        if (E) {
+            errs() << ToolName << ": " << Input << ": " << toString(std::move(E)) << "\n";
+            return 1;
+        }
 
-    for (auto *inst: NonConstOps){
-        if (isInductionVariableUpdate(Ctx, inst, L)){
-            return;
+        Phases.start(AnalysisPhase);
+        Stream.run(F, !NoCLA);
+        Phases.stop(AnalysisPhase);
+
+        if (Verify == VerifyFull && !F.isDeclaration()) {
+            PhaseScope Timed(Phases, VerifyPhase);
+            if (!VerifyFunctions({&F}, 1, Input, ToolName)) return 1;
+        } else if (Verify == VerifyModified) {
+            PhaseScope Timed(Phases, VerifyPhase);
+            if (!VerifyFunctions(Modified, 1, Input, ToolName)) return 1;
+            Modified.clear();
         }
+
+        // blockaddress constants elsewhere may still refer to these blocks
+        if (none_of(F, [](BasicBlock &BB) { return BB.hasAddressTaken(); }))
+            F.deleteBody();
     }
+    PrintProfileSummary(Stats, Input);
+
+    std::string StatsPath = StatsPathFor(Output);
+    if (!StatsPath.empty()) print_csv_file(StatsPath);
+    Stats.print(errs());
+    Phases.report(StatsPath);
+    if (!Trace.write(ToolName)) return 1;
+    Records.keep();
+    return 0;
 }
 
+typedef std::pair<std::string, std::string> BatchJob;
 
-static void AddMetadataToBackEdge(LLVMContext &Ctx, BasicBlock *BB){
-    for (BasicBlock::iterator I = BB->begin(); I != BB->end(); ++I){
-        Instruction &i = *I;
-        if (isa<BranchInst>(i)){
-
-            // we can only add lineno and filename if debug is enabled
-            std::string metadata="cla";
-            if (DILocation *Loc = i.getDebugLoc()) {
-              unsigned Line = Loc->getLine();
+static bool ReadBatchManifest(const std::string &Manifest, std::vector<BatchJob> &Jobs) {
+    std::ifstream In(Manifest);
+    if (!In) {
+        errs() << "cla: cannot open batch manifest " << Manifest << "\n";
+        return false;
+    }
 
-              StringRef File = Loc->getFilename();
-              metadata = formatv("cla: {0}:{1}", File.str(), Line);
-            }
-            
-            MDNode* N = MDNode::get(Ctx, MDString::get(Ctx, metadata));
-            i.setMetadata("backedge: ", N);
+    std::string Line;
+    unsigned LineNo = 0;
+    while (std::getline(In, Line)) {
+        ++LineNo;
+        StringRef L = StringRef(Line).trim();
+        if (L.empty() || L.startswith("#")) continue;
+
+        std::pair<StringRef, StringRef> Job = L.split(' ');
+        StringRef Output = Job.second.trim();
+        if (Output.empty()) {
+            errs() << Manifest << ":" << LineNo << ": expected '<input> <output>'\n";
+            return false;
         }
+        Jobs.push_back(BatchJob(Job.first.str(), Output.str()));
     }
+    return true;
 }
 
-static void AnalyzeLoop(Loop *L, LLVMContext &Context, DominatorTree *DT){
-    NumLoops++;
-    for (auto subloop: L->getSubLoops()){
-       AnalyzeLoop(subloop, Context, DT);
+static bool ScanBatchDir(const std::string &Dir, std::vector<BatchJob> &Jobs) {
+    std::error_code EC;
+    for (sys::fs::recursive_directory_iterator I(Dir, EC), E; I != E && !EC; I.increment(EC)) {
+        StringRef Path = I->path();
+        if (Path.endswith(".opt.bc"))
+            Jobs.push_back(BatchJob(Path.str(), Path.drop_back(strlen(".opt.bc")).str() + ".tune.bc"));
+    }
+    if (EC) {
+        errs() << "cla: cannot scan " << Dir << ": " << EC.message() << "\n";
+        return false;
     }
+    // directory order is arbitrary, keep runs reproducible
+    std::sort(Jobs.begin(), Jobs.end());
+    return true;
+}
 
-    SmallVector<BasicBlock *, 16> ExitBlocks; 
-    getLoopExitBlocks(L, ExitBlocks);
-    FindIndVarUpdateCandidates(Context, L, ExitBlocks);
+// Combine the per-child traces into TraceFile, one process track per
+// module, shifting each onto the common time base.
+static bool MergeBatchTraces(const std::vector<pid_t> &Children, const char *ToolName) {
+    json::Array Events;
+    std::vector<std::pair<int64_t, json::Array>> Parts;
+    int64_t Start = INT64_MAX;
+    for (pid_t Pid : Children) {
+        std::string Path = ChildTracePath(Pid);
+        ErrorOr<std::unique_ptr<MemoryBuffer>> Buf = MemoryBuffer::getFile(Path);
+        if (!Buf) continue; // the child failed before writing it
+        Expected<json::Value> Trace = json::parse((*Buf)->getBuffer());
+        sys::fs::remove(Path);
+        json::Object *Root = Trace ? Trace->getAsObject() : nullptr;
+        if (!Root || !Root->getArray("traceEvents")) {
+            if (!Trace) consumeError(Trace.takeError());
+            errs() << ToolName << ": " << Path << ": malformed trace\n";
+            continue;
+        }
+        int64_t Begin = Root->getInteger("beginningOfTime").getValueOr(0);
+        Start = std::min(Start, Begin);
+        Parts.emplace_back(Begin, std::move(*Root->getArray("traceEvents")));
+    }
 
-    for (BasicBlock *pred: predecessors(L->getHeader())){
-        if (L->contains(pred)){
-            AddMetadataToBackEdge(Context, pred);
+    for (auto &Part : Parts) {
+        for (json::Value &V : Part.second) {
+            json::Object *Event = V.getAsObject();
+            if (Optional<int64_t> TS = Event ? Event->getInteger("ts") : None)
+                (*Event)["ts"] = *TS + (Part.first - Start);
+            Events.push_back(std::move(V));
         }
     }
-}
 
-static void CustomLoopAnalysis(Module *M){
-    DominatorTree *DT = nullptr;
-    LoopInfo *LI = nullptr;
-    LLVMContext &Context = M->getContext();
-    PredicatedScalarEvolution *PSE;
+    std::error_code EC;
+    raw_fd_ostream OS(TraceFile, EC, sys::fs::OF_Text);
+    if (EC) {
+        errs() << ToolName << ": " << TraceFile << ": " << EC.message() << "\n";
+        return false;
+    }
+    OS << json::Value(json::Object{{"traceEvents", std::move(Events)}});
+    return true;
+}
 
-    for (Module::iterator func = M->begin(); func != M->end(); ++func){
-        Function &F = *func;
-        // for empty function, stop considering
-        if (func->begin() == func->end()){
+// Each module is processed in a child forked from this already initialized
+// process: startup and option parsing are paid once, while statistics and
+// crashes stay confined to the module that produced them.
+static int RunBatch(const std::vector<BatchJob> &Jobs, unsigned Workers, const char *ToolName) {
+    if (Workers == 0)
+        Workers = std::max(1u, std::thread::hardware_concurrency());
+
+    std::map<pid_t, const BatchJob *> Running;
+    std::vector<pid_t> Children;
+    unsigned Failed = 0;
+
+    auto Reap = [&]() {
+        int Status;
+        pid_t Pid = wait(&Status);
+        if (Pid < 0) return;
+        const BatchJob *Job = Running[Pid];
+        Running.erase(Pid);
+
+        if (WIFEXITED(Status) && WEXITSTATUS(Status) == 0) return;
+        ++Failed;
+        errs() << ToolName << ": " << Job->first << ": ";
+        if (WIFSIGNALED(Status))
+            errs() << "killed by signal " << WTERMSIG(Status) << "\n";
+        else
+            errs() << "failed with exit code " << WEXITSTATUS(Status) << "\n";
+    };
+
+    for (const BatchJob &Job : Jobs) {
+        while (Running.size() >= Workers) Reap();
+
+        errs().flush();
+        pid_t Pid = fork();
+        if (Pid == 0) {
+            // the server's pool threads are not forked along; never join them
+            ServerPool.release();
+            // the worker processes already provide the parallelism
+            int RC = Lazy ? ProcessModuleLazy(Job.first, Job.second, ToolName)
+                          : ProcessModule(Job.first, Job.second, ToolName, 1);
+            errs().flush();
+            _exit(RC);
+        }
+        if (Pid < 0) {
+            errs() << ToolName << ": " << Job.first << ": fork failed\n";
+            ++Failed;
             continue;
         }
+        Running[Pid] = &Job;
+        Children.push_back(Pid);
+    }
+    while (!Running.empty()) Reap();
 
-        DT = new DominatorTree(F); // dominance for Function, F
-        LoopInfoBase<BasicBlock,Loop> *LI = new LoopInfoBase<BasicBlock,Loop>();
-        LI->analyze(*DT); // calculate loop info
+    if (!TraceFile.empty() && !MergeBatchTraces(Children, ToolName))
+        ++Failed;
 
-        for(auto li: *LI) {
-            AnalyzeLoop(li, Context, DT);
+    errs() << ToolName << ": processed " << Jobs.size() << " modules, "
+           << Failed << " failed\n";
+    return Failed ? 1 : 0;
+}
+
+// Run whatever the parsed options ask for: a batch or a single module.
+static int RunCommand(const char *ToolName) {
+    if (!BatchManifest.empty() || !BatchDir.empty()) {
+        // every module would overwrite the one file, side by side under -j
+        if (!StatsFile.empty()) {
+            errs() << ToolName << ": -stats-file cannot be combined with -batch or -batch-dir\n";
+            return 1;
         }
+        std::vector<BatchJob> Jobs;
+        if (!BatchManifest.empty() && !ReadBatchManifest(BatchManifest, Jobs))
+            return 1;
+        if (!BatchDir.empty() && !ScanBatchDir(BatchDir, Jobs))
+            return 1;
+        return RunBatch(Jobs, Threads, ToolName);
+    }
+
+    if (OutputFilename.getNumOccurrences() && !OutputOption.empty()) {
+        errs() << ToolName << ": -o cannot be combined with <output bitcode>\n";
+        return 1;
+    }
+    if (OutputFilename.getNumOccurrences() == 0 && OutputOption.empty()) {
+        errs() << ToolName << ": expected <input bitcode> <output bitcode>\n";
+        cl::PrintHelpMessage();
+        return 1;
     }
+    std::string Output = OutputOption.empty() ? std::string(OutputFilename) : OutputOption;
+    if (OutputAssembly && Emit != EmitBitcode) {
+        errs() << ToolName << ": -S cannot be combined with -emit=asm or -emit=obj\n";
+        return 1;
+    }
+
+    if (Lazy)
+        return ProcessModuleLazy(InputFilename, Output, ToolName);
+    return ProcessModule(InputFilename, Output, ToolName, Threads);
+}
+
+int main(int argc, char **argv) {
+    // Parse command line arguments
+    cl::ParseCommandLineOptions(argc, argv, "llvm system compiler\n");
+
+    // Handle creating output files and shutting down properly
+    llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
+
+    if (!Serve.empty()) {
+        // options are re-parsed for every request, keep what the server needs
+        std::string Socket = Serve;
+        ServerPool.reset(new ThreadPool(hardware_concurrency(Threads)));
+        const char *ToolName = argv[0];
+        ServerHooks Hooks;
+        Hooks.ReadsStdin = [] {
+            return BatchManifest.empty() && BatchDir.empty() && InputFilename == "-";
+        };
+        Hooks.Run = [ToolName] { return RunCommand(ToolName); };
+        return RunServer(Socket, ToolName, Hooks);
+    }
+
+    return RunCommand(argv[0]);
 }
@@ -0,0 +1,2016 @@
+#include <memory>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/CheckedArithmetic.h"
+#include "llvm/Support/CrashRecoveryContext.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/BasicAliasAnalysis.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+
+#include "loop_analysis.h"
+#include "cla_metadata.h"
+#include "cla_stats.h"
+
+#define DEBUG_TYPE "cla"
+
+using namespace llvm;
+
+void print_csv_file(std::string statsfile)
+{
+    std::error_code EC;
+    raw_fd_ostream stats(statsfile, EC, sys::fs::OF_Text);
+    StatsScope::current().writeCSV(stats);
+}
+
+// What the analysis decided to attach to an instruction. Analysis only
+// records these; the metadata itself is created later, in module order, by
+// CommitFunctionResult so threaded runs produce the same bitcode as serial.
+enum AnnotationKind {
+    IVUpdateAnnotation,
+    BackEdgeAnnotation
+};
+
+struct Annotation {
+    Instruction *I;
+    AnnotationKind Kind;
+    unsigned Loop; // preorder index into FunctionResult::LoopResults
+};
+
+struct LoopShape {
+    unsigned Blocks = 0;
+    unsigned Instructions = 0;
+    unsigned Loads = 0;
+    unsigned Stores = 0;
+    unsigned Calls = 0;
+
+    LoopShape &operator+=(const LoopShape &O) {
+        Blocks += O.Blocks;
+        Instructions += O.Instructions;
+        Loads += O.Loads;
+        Stores += O.Stores;
+        Calls += O.Calls;
+        return *this;
+    }
+};
+
+// One row of the -loop-records output.
+struct LoopRecord {
+    unsigned Index = 0; // preorder position in the function
+    unsigned Depth = 0;
+    std::string Location;
+    LoopShape Shape;
+    bool Preheader = false;
+    unsigned Latches = 0;
+    unsigned Exiting = 0;
+    unsigned Exits = 0;
+    const char *IVKind = "none"; // "scev" (register IV) or "memory"
+    std::string IVStart;
+    std::string IVStep;
+    const char *TripKind = "unknown"; // "exact" or "max" when bounded
+    std::string TripCount;            // constant, or SCEV expression for "max"
+};
+
+// What is committed to a loop's llvm.loop ID. Unlike LoopRecord this is
+// always collected when annotating.
+struct LoopResult {
+    Instruction *Anchor = nullptr; // its debug location names the loop
+    Instruction *Latch = nullptr;  // terminator of the first latch
+    int Parent = -1;               // preorder index, -1 at the top level
+    uint64_t Shape = 0;            // structural hash, see StructuralHash
+    const char *IVKind = "";       // "scev" or "memory" once an IV is found
+    Optional<int64_t> IVStep;      // when the step is a constant
+    const char *Memory = "";       // see MemoryClass
+    const char *TripKind = "";     // "exact", "max" or "unknown", see ComputeTripCount
+    Optional<uint64_t> TripCount;  // the count, or its constant bound for "max"
+    BranchInst *Exit = nullptr;    // only with a profile, see ProfiledBranch
+    unsigned StaySucc = 0;         // the successor of Exit inside the loop
+    double HeaderFreq = 0;         // with -static-hotness: header runs per call
+    uint64_t Weight = 0;           // and per program run, see EstimateLoopWeights
+
+    // Filled in by AssignLoopIds from the above, after the analysis or a
+    // cache hit: they depend on names and debug locations, which the cache
+    // key leaves out.
+    uint64_t Id = 0;
+    const DILocation *Start = nullptr;
+};
+
+// How a loop, subloops included, touches memory. Calls may do anything.
+static const char *MemoryClass(const LoopShape &S) {
+    if (S.Calls) return "unknown";
+    if (S.Loads && S.Stores) return "readwrite";
+    if (S.Loads) return "readonly";
+    if (S.Stores) return "writeonly";
+    return "readnone";
+}
+
+// Where the loop starts in the source, as Loop::getStartLoc finds it: a
+// location the front end put in the loop ID, else the anchor's.
+static const DILocation *StartLoc(const LoopResult &Loop) {
+    if (MDNode *ID = Loop.Latch ? Loop.Latch->getMetadata(LLVMContext::MD_loop) : nullptr) {
+        for (const MDOperand &Op : drop_begin(ID->operands())) {
+            if (auto *Loc = dyn_cast_or_null<DILocation>(Op.get())) return Loc;
+        }
+    }
+    return Loop.Anchor ? Loop.Anchor->getDebugLoc().get() : nullptr;
+}
+
+// Low 64 bits of MD5(Parent, Component).
+static uint64_t HashLoopKey(uint64_t Parent, StringRef Component) {
+    MD5 H;
+    H.update(makeArrayRef(reinterpret_cast<const uint8_t *>(&Parent), sizeof(Parent)));
+    H.update(Component);
+    MD5::MD5Result Result;
+    H.final(Result);
+    return Result.low();
+}
+
+// Calls from one function to a defined one, per call of the caller.
+struct CallEstimate {
+    Function *Callee;
+    double Freq;
+    bool Recursive; // closes a cycle; not followed, see EstimateLoopWeights
+};
+
+struct FunctionResult {
+    Function *F = nullptr;
+    std::vector<Annotation> Annotations;
+    std::vector<LoopResult> LoopResults; // in loop preorder, when annotating
+    std::vector<LoopRecord> Loops; // in loop preorder, only with -loop-records
+    std::vector<unsigned> Hoisted; // per loop in preorder, only with -licm
+    bool Changed = false;          // -licm moved code or added a preheader
+    std::vector<CallEstimate> Calls; // only with -static-hotness
+    double Runs = 0;               // estimated calls per program run, likewise
+    double Seconds = 0;            // only with function timing
+    // statistics this function contributes; added to the worker's shard
+    // once the function is done
+    std::array<uint64_t, NumStats> Counts = {};
+};
+
+static void Count(FunctionResult &R, Stat S, uint64_t N = 1){
+    R.Counts[unsigned(S)] += N;
+}
+
+// Stable loop IDs: the function name, then from the outermost loop in, the
+// start location (file, line, column) of every enclosing loop, or its
+// structural hash where there is no debug info. No pointer or preorder
+// position goes in, so a source loop keeps its ID across runs and across
+// optimization levels as long as its location survives. Loops that would
+// collide (one macro expanding to two loops) are told apart in preorder.
+static void AssignLoopIds(FunctionResult &R){
+    uint64_t Root = HashLoopKey(0, R.F->getName());
+    DenseSet<uint64_t> Used;
+    for (LoopResult &Loop : R.LoopResults) {
+        Loop.Start = StartLoc(Loop);
+        std::string Component;
+        if (Loop.Start) {
+            Component = formatv("{0}:{1}:{2}", Loop.Start->getFilename(), Loop.Start->getLine(),
+                                Loop.Start->getColumn());
+            AddStat(Stat::NumLoopIdsFromDebugLoc);
+        } else {
+            Component = formatv("#{0:x-}", Loop.Shape);
+            AddStat(Stat::NumLoopIdsStructural);
+        }
+        uint64_t Parent = Loop.Parent < 0 ? Root : R.LoopResults[Loop.Parent].Id;
+        Loop.Id = HashLoopKey(Parent, Component);
+        while (!Used.insert(Loop.Id).second) Loop.Id = HashLoopKey(Loop.Id, "dup");
+    }
+}
+
+static std::string FormatLoopId(uint64_t Id){
+    return formatv("{0}", format_hex_no_prefix(Id, 16));
+}
+
+// Hot loops are the most run ones that together make up 99% of all header
+// runs, the cutoff LLVM's profile summary uses for hot code. Returns the
+// fewest runs a hot loop has.
+static uint64_t HotCutoff(std::vector<uint64_t> Runs){
+    uint64_t Total = 0;
+    for (uint64_t N : Runs) Total = SaturatingAdd(Total, N);
+    std::sort(Runs.begin(), Runs.end(), std::greater<uint64_t>());
+    uint64_t Sum = 0, Cutoff = 0;
+    for (uint64_t N : Runs) {
+        if (!N || Sum >= Total - Total / 100) break;
+        Cutoff = N;
+        Sum = SaturatingAdd(Sum, N);
+    }
+    return Cutoff;
+}
+
+// One CustomLoopAnalysis call, or one FunctionStreamAnalysis: its options
+// plus what is derived from them for the whole module.
+class AnalysisRun {
+public:
+    explicit AnalysisRun(const AnalysisOptions &Options) : Opts(Options) {
+        if (!Opts.Profile) return;
+        std::vector<uint64_t> Runs;
+        for (auto &Entry : *Opts.Profile) Runs.push_back(Entry.second.Headers);
+        HotIterations = HotCutoff(std::move(Runs));
+    }
+
+    // The -use-profile counts of loop Id, if it has any.
+    const CLALoopCounts *counts(uint64_t Id) const {
+        if (!Opts.Profile) return nullptr;
+        auto It = Opts.Profile->find(Id);
+        return It == Opts.Profile->end() ? nullptr : &It->second;
+    }
+
+    const char *heat(const CLALoopCounts &C) const {
+        return C.Headers && C.Headers >= HotIterations ? "hot" : "cold";
+    }
+
+    const char *estimatedHeat(const LoopResult &Loop) const {
+        return Loop.Weight && Loop.Weight >= HotWeight ? "hot" : "cold";
+    }
+
+    const AnalysisOptions Opts;
+    uint64_t HotIterations = 0;
+    uint64_t HotWeight = 0; // set by EstimateLoopWeights
+};
+
+static const char *RecordColumns =
+    "id,function,location,depth,blocks,instructions,loads,stores,calls,"
+    "preheader,latches,exiting,exits,iv,iv_start,iv_step,trip,trip_count,hoisted,"
+    "heat,iterations,est_heat,est_weight";
+
+void WriteLoopRecordHeader(raw_ostream &OS, LoopRecordFormat Format){
+    if (Format == LoopRecordFormat::CSV) OS << RecordColumns << '\n';
+}
+
+static void WriteCSVField(raw_ostream &OS, StringRef Field){
+    if (Field.find_first_of(",\"\n") == StringRef::npos) {
+        OS << Field;
+        return;
+    }
+    OS << '"';
+    for (char C : Field) {
+        if (C == '"') OS << '"';
+        OS << C;
+    }
+    OS << '"';
+}
+
+static void WriteLoopRecords(const AnalysisRun &Run, const FunctionResult &R){
+    raw_ostream &OS = *Run.Opts.Records;
+    bool StaticHotness = Run.Opts.StaticHotness;
+    StringRef Fn = R.F->getName();
+    for (const LoopRecord &Rec : R.Loops) {
+        std::string Id = FormatLoopId(R.LoopResults[Rec.Index].Id);
+        unsigned Hoisted = R.Hoisted.empty() ? 0 : R.Hoisted[Rec.Index];
+        const LoopResult &Loop = R.LoopResults[Rec.Index];
+        const CLALoopCounts *Counts = Run.counts(Loop.Id);
+        const LoopShape &S = Rec.Shape;
+        if (Run.Opts.RecordFormat == LoopRecordFormat::CSV) {
+            WriteCSVField(OS, Id);
+            OS << ',';
+            WriteCSVField(OS, Fn);
+            OS << ',';
+            WriteCSVField(OS, Rec.Location);
+            OS << ',' << Rec.Depth << ',' << S.Blocks << ',' << S.Instructions << ','
+               << S.Loads << ',' << S.Stores << ',' << S.Calls << ',' << Rec.Preheader << ','
+               << Rec.Latches << ',' << Rec.Exiting << ',' << Rec.Exits << ',' << Rec.IVKind << ',';
+            WriteCSVField(OS, Rec.IVStart);
+            OS << ',';
+            WriteCSVField(OS, Rec.IVStep);
+            OS << ',' << Rec.TripKind << ',';
+            WriteCSVField(OS, Rec.TripCount);
+            OS << ',' << Hoisted << ',';
+            if (Counts) OS << Run.heat(*Counts) << ',' << Counts->Headers;
+            else OS << ',';
+            OS << ',';
+            if (StaticHotness) OS << Run.estimatedHeat(Loop) << ',' << Loop.Weight;
+            else OS << ',';
+            OS << '\n';
+            continue;
+        }
+
+        json::OStream J(OS);
+        J.object([&] {
+            J.attribute("id", Id);
+            J.attribute("function", Fn);
+            J.attribute("location", Rec.Location);
+            J.attribute("depth", Rec.Depth);
+            J.attribute("blocks", S.Blocks);
+            J.attribute("instructions", S.Instructions);
+            J.attribute("loads", S.Loads);
+            J.attribute("stores", S.Stores);
+            J.attribute("calls", S.Calls);
+            J.attribute("preheader", Rec.Preheader);
+            J.attribute("latches", Rec.Latches);
+            J.attribute("exiting", Rec.Exiting);
+            J.attribute("exits", Rec.Exits);
+            J.attribute("iv", Rec.IVKind);
+            J.attribute("iv_start", Rec.IVStart);
+            J.attribute("iv_step", Rec.IVStep);
+            J.attribute("trip", Rec.TripKind);
+            J.attribute("trip_count", Rec.TripCount);
+            J.attribute("hoisted", Hoisted);
+            J.attribute("heat", Counts ? Run.heat(*Counts) : "");
+            J.attribute("iterations", Counts ? json::Value(Counts->Headers) : nullptr);
+            J.attribute("est_heat", StaticHotness ? Run.estimatedHeat(Loop) : "");
+            J.attribute("est_weight", StaticHotness ? json::Value(Loop.Weight) : nullptr);
+        });
+        OS << '\n';
+    }
+}
+
+// The lock workers take around the shared LLVMContext. It remembers its
+// holder, so a worker recovering from a crash can let go of it instead of
+// leaving the others blocked.
+class ContextMutex {
+public:
+    void lock() {
+        M.lock();
+        Owner = std::this_thread::get_id();
+    }
+
+    void unlock() {
+        Owner = std::thread::id();
+        M.unlock();
+    }
+
+    void releaseIfHeld() {
+        if (Owner == std::this_thread::get_id()) unlock();
+    }
+
+private:
+    std::mutex M;
+    std::atomic<std::thread::id> Owner;
+};
+
+// Per-worker analysis state reused from one function to the next. The
+// dominator tree and loop info are recalculated in place instead of being
+// allocated per function, and per-function scratch lists live in a bump
+// allocator that is reset between functions, so memory stays flat no matter
+// how many functions the module has.
+//
+// ScalarEvolution and MemorySSA are only built for functions that need them.
+// They register value handles and create constants in the shared
+// LLVMContext, so when several workers run, all such work happens under
+// ContextLock.
+class AnalysisContext {
+public:
+    DominatorTree DT;
+    LoopInfo LI;
+
+    explicit AnalysisContext(ContextMutex *ContextLock = nullptr) : ContextLock(ContextLock) {}
+    ~AnalysisContext() { release(); }
+
+    void analyze(Function &F) {
+        releaseLazy();
+        LI.releaseMemory();
+        Scratch.Reset();
+        Fn = &F;
+        {
+            TimeTraceScope Trace("DominatorTree");
+            DT.recalculate(F);
+        }
+        {
+            TimeTraceScope Trace("LoopInfo");
+            LI.analyze(DT);
+        }
+    }
+
+    void release() {
+        releaseLazy();
+        LI.releaseMemory();
+        DT.reset();
+        Scratch.Reset();
+        Fn = nullptr;
+    }
+
+    // Hold the returned lock for as long as SCEV or MemorySSA results are
+    // in use.
+    std::unique_lock<ContextMutex> lockContext() {
+        return ContextLock ? std::unique_lock<ContextMutex>(*ContextLock)
+                           : std::unique_lock<ContextMutex>();
+    }
+
+    ScalarEvolution &getSE() {
+        if (!SE)
+            SE.emplace(*Fn, getTLI(), getAC(), DT, LI);
+        return *SE;
+    }
+
+    // BasicAA, enough to tell distinct allocas apart at -O0.
+    AAResults &getAA() {
+        if (!AA) {
+            BasicAA.emplace(Fn->getParent()->getDataLayout(), *Fn, getTLI(), getAC(), &DT);
+            AA.emplace(getTLI());
+            AA->addAAResult(*BasicAA);
+        }
+        return *AA;
+    }
+
+    // Static block frequencies: BranchProbabilityInfo's heuristics, or the
+    // !prof weights where the input has them.
+    BlockFrequencyInfo &getBFI() {
+        if (!BFI) {
+            TimeTraceScope Trace("BlockFrequencyInfo");
+            BPI.emplace(*Fn, LI, &getTLI(), &DT);
+            BFI.emplace(*Fn, *BPI, LI);
+        }
+        return *BFI;
+    }
+
+    MemorySSA &getMSSA() {
+        if (!MSSA) {
+            TimeTraceScope Trace("MemorySSA");
+            MSSA.emplace(*Fn, &getAA(), &DT);
+        }
+        return *MSSA;
+    }
+
+    // Copy a short-lived list into the arena; valid until the next analyze().
+    template <typename T> ArrayRef<T> copy(ArrayRef<T> Src) {
+        T *Dst = Scratch.Allocate<T>(Src.size());
+        std::uninitialized_copy(Src.begin(), Src.end(), Dst);
+        return ArrayRef<T>(Dst, Src.size());
+    }
+
+    // Reusable buffer for collecting lists before they are copied out.
+    template <typename T> SmallVectorImpl<T> &buffer();
+
+private:
+    TargetLibraryInfo &getTLI() {
+        if (!TLI) {
+            if (!TLII)
+                TLII.reset(new TargetLibraryInfoImpl(Triple(Fn->getParent()->getTargetTriple())));
+            TLI.emplace(*TLII, Fn);
+        }
+        return *TLI;
+    }
+
+    AssumptionCache &getAC() {
+        if (!AssumptionC)
+            AssumptionC.emplace(*Fn);
+        return *AssumptionC;
+    }
+
+    void releaseLazy() {
+        if (!TLI) return;
+        std::unique_lock<ContextMutex> Guard = lockContext();
+        MSSA.reset();
+        BFI.reset();
+        BPI.reset();
+        AA.reset();
+        BasicAA.reset();
+        SE.reset();
+        AssumptionC.reset();
+        TLI.reset();
+    }
+
+    Function *Fn = nullptr;
+    ContextMutex *ContextLock;
+    std::unique_ptr<TargetLibraryInfoImpl> TLII;
+    Optional<TargetLibraryInfo> TLI;
+    Optional<AssumptionCache> AssumptionC;
+    Optional<ScalarEvolution> SE;
+    Optional<BasicAAResult> BasicAA;
+    Optional<AAResults> AA;
+    Optional<MemorySSA> MSSA;
+    Optional<BranchProbabilityInfo> BPI;
+    Optional<BlockFrequencyInfo> BFI;
+    BumpPtrAllocator Scratch;
+    SmallVector<BasicBlock *, 16> BlockBuffer;
+    SmallVector<Instruction *, 16> InstBuffer;
+};
+
+template <> SmallVectorImpl<BasicBlock *> &AnalysisContext::buffer() {
+    BlockBuffer.clear();
+    return BlockBuffer;
+}
+
+template <> SmallVectorImpl<Instruction *> &AnalysisContext::buffer() {
+    InstBuffer.clear();
+    return InstBuffer;
+}
+
+// An affine induction variable: a header PHI whose SCEV is {Start,+,Step}
+// in this loop. Update is the value flowing back in over the latch.
+struct InductionInfo {
+    PHINode *Phi;
+    Instruction *Update;
+    const SCEV *Start;
+    const SCEV *Step;
+    int Direction; // +1 counts up, -1 counts down, 0 unknown sign
+};
+
+static bool CollectInductionVariables(Loop *L, PredicatedScalarEvolution &PSE,
+                                      SmallVectorImpl<InductionInfo> &IVs){
+    BasicBlock *LoopLatch = L->getLoopLatch();
+    if (!LoopLatch) return false;
+
+    ScalarEvolution *SE = PSE.getSE();
+    for (PHINode &PN : L->getHeader()->phis()) {
+        if (!SE->isSCEVable(PN.getType())) continue;
+
+        // integer, pointer (GEP recurrences) and widened IVs all show up
+        // as an affine add recurrence on this loop
+        const auto *AR = dyn_cast<SCEVAddRecExpr>(PSE.getSCEV(&PN));
+        if (!AR || AR->getLoop() != L || !AR->isAffine()) continue;
+
+        auto *Update = dyn_cast<Instruction>(PN.getIncomingValueForBlock(LoopLatch));
+        if (!Update || !L->contains(Update)) continue;
+
+        const SCEV *Step = AR->getStepRecurrence(*SE);
+        int Direction = 0;
+        if (SE->isKnownPositive(Step)) Direction = 1;
+        else if (SE->isKnownNegative(Step)) Direction = -1;
+
+        LLVM_DEBUG(dbgs() << "induction variable " << PN << " start "
+                          << *AR->getStart() << " step " << *Step << "\n");
+        IVs.push_back({&PN, Update, AR->getStart(), Step, Direction});
+    }
+
+    return !IVs.empty();
+}
+
+static ArrayRef<BasicBlock*> getLoopExitBlocks(Loop *L, AnalysisContext &AC){
+    SmallVectorImpl<BasicBlock*> &ExitingBBs = AC.buffer<BasicBlock*>();
+    L->getExitingBlocks(ExitingBBs);
+
+    for (auto it = ExitingBBs.begin(); it != ExitingBBs.end();) {
+        auto *BI = dyn_cast<BranchInst>((*it)->getTerminator());
+        if (!BI || (!BI->isConditional())){
+            it = ExitingBBs.erase(it);
+       
+        } else {
+            // If the item meets the criteria, move to the next item
+            LLVM_DEBUG(dbgs() << "considering exit block ";
+                       (*it)->printAsOperand(dbgs(), false); dbgs() << "\n");
+            ++it;
+        }
+    }
+
+    return AC.copy<BasicBlock*>(ExitingBBs);
+
+    /*
+    BasicBlock *ExitingBB = nullptr;
+    for (auto *ExitingBB: ExitingBBs){
+        errs() << "Considering Exiting BB " << ExitingBB << "\n";    
+        auto *BI = dyn_cast<BranchInst>(ExitingBB->getTerminator());
+        if (!BI)
+            Changed = true;
+            continue;
+        assert(BI->isConditional() && "exit branch must be conditional");
+
+        auto *ICmp = dyn_cast<ICmpInst>(BI->getCondition());
+        if (!ICmp || !ICmp->hasOneUse())
+            Changed = true;
+            continue;
+
+        auto *LHS = ICmp->getOperand(0);
+        auto *RHS = ICmp->getOperand(1);
+        // For the range reasoning, avoid computing SCEVs in the loop to avoid
+        // poisoning cache with sub-optimal results.  For the must-execute case,
+        // this is a neccessary precondition for correctness.
+        if (!L->isLoopInvariant(RHS)) {
+          if (!L->isLoopInvariant(LHS))
+            Changed = true;
+            continue;
+          // Same logic applies for the inverse case
+          std::swap(LHS, RHS);
+        }
+
+        ExitingBBs.push_back(ExitingBB);
+    }
+    */
+
+}
+
+// Look through the casts a widened IV leaves between itself and a compare.
+static Value *StripIVCasts(Value *V){
+    while (auto *Cast = dyn_cast<CastInst>(V)) {
+        if (!isa<SExtInst>(Cast) && !isa<ZExtInst>(Cast) && !isa<TruncInst>(Cast))
+            break;
+        V = Cast->getOperand(0);
+    }
+    return V;
+}
+
+// The compares deciding whether a conditional exiting branch leaves L.
+static ArrayRef<Instruction *> getExitCompares(Loop *L, ArrayRef<BasicBlock*> ExitBlocks,
+                                               AnalysisContext &AC){
+    SmallVectorImpl<Instruction *> &Compares = AC.buffer<Instruction *>();
+    for (BasicBlock *BB : ExitBlocks) {
+        auto *BI = cast<BranchInst>(BB->getTerminator());
+        auto *Cmp = dyn_cast<CmpInst>(BI->getCondition());
+        if (Cmp && L->contains(Cmp) && !is_contained(Compares, Cmp)) {
+            LLVM_DEBUG(dbgs() << "exit compare " << *Cmp << "\n");
+            Compares.push_back(Cmp);
+        }
+    }
+    return AC.copy<Instruction *>(Compares);
+}
+
+// Is BO "load Ptr +/- loop invariant" where the load sees the value that
+// was live on entry to the header (clobbered by the header MemoryPhi)?
+static bool isMemoryRecurrence(BinaryOperator *BO, Value *Ptr, MemoryPhi *HeaderPhi,
+                               Loop *L, MemorySSAWalker *Walker){
+    if (!L->contains(BO)) return false;
+
+    Value *Op0 = BO->getOperand(0), *Op1 = BO->getOperand(1);
+    if (BO->getOpcode() == Instruction::Add && L->isLoopInvariant(Op0))
+        std::swap(Op0, Op1);
+    else if (BO->getOpcode() != Instruction::Add &&
+             BO->getOpcode() != Instruction::Sub)
+        return false;
+
+    auto *Prev = dyn_cast<LoadInst>(Op0);
+    if (!Prev || !Prev->isSimple() || Prev->getPointerOperand() != Ptr ||
+        !L->isLoopInvariant(Op1))
+        return false;
+    return Walker->getClobberingMemoryAccess(Prev) == HeaderPhi;
+}
+
+// IVs that were not promoted to registers (-O0 input) live in memory. With
+// MemorySSA the recurrence is: the exit compare loads Ptr, the value comes
+// from the header MemoryPhi, and along the backedge that phi is fed by a
+// store of "load Ptr +/- step" to the same Ptr. Nothing is rewritten, so the
+// IR shipped downstream is the IR that came in. Every pointer is inspected
+// once per loop through the Memo table.
+static Instruction *FindMemoryIVUpdate(Value *V, Loop *L, MemorySSA &MSSA,
+                                       DenseMap<Value *, Instruction *> &Memo){
+    auto *Load = dyn_cast<LoadInst>(V);
+    if (!Load || !Load->isSimple() || !L->contains(Load)) return nullptr;
+
+    Value *Ptr = Load->getPointerOperand();
+    auto It = Memo.find(Ptr);
+    if (It != Memo.end()) return It->second;
+
+    Instruction *Update = nullptr;
+    MemorySSAWalker *Walker = MSSA.getWalker();
+    MemoryLocation Loc = MemoryLocation::get(Load);
+    MemoryAccess *Clobber = Walker->getClobberingMemoryAccess(Load);
+
+    if (auto *Phi = dyn_cast<MemoryPhi>(Clobber)) {
+        // compare at the top of the loop: follow the backedge value
+        if (Phi->getBlock() == L->getHeader()) {
+            for (unsigned i = 0, e = Phi->getNumIncomingValues(); i != e; ++i) {
+                if (!L->contains(Phi->getIncomingBlock(i))) continue;
+                MemoryAccess *In = Walker->getClobberingMemoryAccess(Phi->getIncomingValue(i), Loc);
+                auto *Def = dyn_cast<MemoryDef>(In);
+                auto *Store = Def ? dyn_cast_or_null<StoreInst>(Def->getMemoryInst()) : nullptr;
+                auto *BO = Store && Store->getPointerOperand() == Ptr
+                               ? dyn_cast<BinaryOperator>(Store->getValueOperand()) : nullptr;
+                if (!BO || !isMemoryRecurrence(BO, Ptr, Phi, L, Walker)) {
+                    Update = nullptr;
+                    break;
+                }
+                if (Update && Update != BO) {
+                    Update = nullptr; // different updates on different latches
+                    break;
+                }
+                Update = BO;
+            }
+        }
+    } else if (auto *Def = dyn_cast<MemoryDef>(Clobber)) {
+        // compare after the update, e.g. do-while: the load sees the store
+        auto *Store = dyn_cast_or_null<StoreInst>(Def->getMemoryInst());
+        if (Store && Store->getPointerOperand() == Ptr && L->contains(Store)) {
+            MemoryAccess *HeaderAccess = MSSA.getMemoryAccess(L->getHeader());
+            auto *HeaderPhi = dyn_cast_or_null<MemoryPhi>(HeaderAccess);
+            auto *BO = dyn_cast<BinaryOperator>(Store->getValueOperand());
+            if (HeaderPhi && BO && isMemoryRecurrence(BO, Ptr, HeaderPhi, L, Walker))
+                Update = BO;
+        }
+    }
+
+    if (Update)
+        LLVM_DEBUG(dbgs() << "memory induction update " << *Update << "\n");
+    Memo[Ptr] = Update;
+    return Update;
+}
+
+// The step a memory IV update adds: "load +/- Step".
+static std::string DescribeMemoryStep(Instruction *Update){
+    auto *BO = cast<BinaryOperator>(Update);
+    Value *Step = BO->getOperand(1);
+    if (isa<LoadInst>(Step)) Step = BO->getOperand(0);
+
+    std::string Text;
+    raw_string_ostream OS(Text);
+    if (auto *C = dyn_cast<ConstantInt>(Step))
+        OS << (BO->getOpcode() == Instruction::Sub ? -C->getSExtValue() : C->getSExtValue());
+    else
+        Step->printAsOperand(OS, false);
+    return OS.str();
+}
+
+static Optional<int64_t> ConstantMemoryStep(Instruction *Update){
+    auto *BO = cast<BinaryOperator>(Update);
+    auto *C = dyn_cast<ConstantInt>(BO->getOperand(1));
+    if (!C) C = dyn_cast<ConstantInt>(BO->getOperand(0));
+    if (!C || C->getBitWidth() > 64) return None;
+    return BO->getOpcode() == Instruction::Sub ? -C->getSExtValue() : C->getSExtValue();
+}
+
+static Optional<int64_t> ConstantSCEVStep(const SCEV *Step){
+    auto *C = dyn_cast<SCEVConstant>(Step);
+    if (!C || C->getAPInt().getMinSignedBits() > 64) return None;
+    return C->getAPInt().getSExtValue();
+}
+
+// The kind and step of the first IV found go to the loop's LoopResult and,
+// with more detail, to Rec when given.
+static void FindIndVarUpdateCandidates(Loop *L, unsigned LoopIndex,
+                                       ArrayRef<BasicBlock*> ExitBlocks,
+                                       AnalysisContext &AC, FunctionResult &R,
+                                       LoopRecord *Rec){
+    ArrayRef<Instruction *> ExitCompares = getExitCompares(L, ExitBlocks, AC);
+    if (ExitCompares.empty()){
+        LLVM_DEBUG(dbgs() << "FOUND NO UPDATE VAR\n");
+        return;
+    }
+
+    LoopResult &Res = R.LoopResults[LoopIndex];
+    SmallPtrSet<Instruction *, 4> Marked;
+    auto Mark = [&](Instruction *Update) {
+        if (Marked.insert(Update).second) {
+            R.Annotations.push_back({Update, IVUpdateAnnotation, LoopIndex});
+            Count(R, Stat::NumIVUpdates);
+        }
+    };
+
+    // register IVs: one SCEV classification of the header PHIs, then one
+    // pass over the exit compares
+    if (isa<PHINode>(L->getHeader()->front())) {
+        std::unique_lock<ContextMutex> Guard = AC.lockContext();
+        PredicatedScalarEvolution PSE(AC.getSE(), *L);
+        SmallVector<InductionInfo, 4> IVs;
+        if (CollectInductionVariables(L, PSE, IVs)) {
+            Count(R, Stat::NumIndVars, IVs.size());
+            DenseMap<Value *, InductionInfo *> IVFor;
+            for (InductionInfo &IV : IVs) {
+                IVFor[IV.Phi] = &IV;
+                IVFor[IV.Update] = &IV;
+            }
+            for (Instruction *Cmp : ExitCompares) {
+                for (Value *Op : Cmp->operands()) {
+                    auto It = IVFor.find(StripIVCasts(Op));
+                    if (It == IVFor.end()) continue;
+                    if (Marked.empty()) {
+                        Res.IVKind = "scev";
+                        Res.IVStep = ConstantSCEVStep(It->second->Step);
+                    }
+                    if (Rec && Marked.empty()) {
+                        Rec->IVKind = "scev";
+                        raw_string_ostream(Rec->IVStart) << *It->second->Start;
+                        raw_string_ostream(Rec->IVStep) << *It->second->Step;
+                    }
+                    Mark(It->second->Update);
+                }
+            }
+        }
+    }
+    if (!Marked.empty()) return;
+
+    // memory-resident IVs, only worth building MemorySSA when the exit
+    // compare reads memory at all
+    bool ReadsMemory = any_of(ExitCompares, [](Instruction *Cmp) {
+        return any_of(Cmp->operands(), [](Value *Op) {
+            return isa<LoadInst>(StripIVCasts(Op));
+        });
+    });
+    if (!ReadsMemory) return;
+
+    std::unique_lock<ContextMutex> Guard = AC.lockContext();
+    MemorySSA &MSSA = AC.getMSSA();
+    DenseMap<Value *, Instruction *> Memo;
+    for (Instruction *Cmp : ExitCompares) {
+        for (Value *Op : Cmp->operands()) {
+            Instruction *Update = FindMemoryIVUpdate(StripIVCasts(Op), L, MSSA, Memo);
+            if (!Update) continue;
+            if (Marked.empty()) {
+                Res.IVKind = "memory";
+                Res.IVStep = ConstantMemoryStep(Update);
+            }
+            if (Rec && Marked.empty()) {
+                Rec->IVKind = "memory";
+                Rec->IVStep = DescribeMemoryStep(Update);
+            }
+            Mark(Update);
+        }
+    }
+}
+
+// Number of times "stay in the loop while V <Pred> Bound" holds for
+// V = V0, V0 + Step, ..., or None if V would wrap around the Bits wide type
+// first. Values are sign or zero extended as Pred compares them.
+static Optional<uint64_t> CountWhile(CmpInst::Predicate Pred, int64_t V0, int64_t Step,
+                                     int64_t Bound, unsigned Bits){
+    bool Unsigned = ICmpInst::isUnsigned(Pred);
+    int64_t Hi = Unsigned && Bits < 64 ? (int64_t(1) << Bits) - 1 : INT64_MAX >> (64 - Bits);
+    int64_t Lo = Unsigned ? 0 : -Hi - 1;
+    if (Step == 0 || Step == INT64_MIN || V0 < Lo || V0 > Hi || Bound < Lo || Bound > Hi)
+        return None;
+    Optional<int64_t> Diff = checkedSub(Bound, V0);
+    // INT64_MIN / -1 overflows (and traps) in the divisions below
+    if (!Diff || (*Diff == INT64_MIN && Step == -1)) return None;
+
+    // the first value failing the predicate must still be in range
+    auto Checked = [&](int64_t N) -> Optional<uint64_t> {
+        Optional<int64_t> Last = checkedMul(N, Step);
+        if (Last) Last = checkedAdd(*Last, V0);
+        if (!Last || *Last < Lo || *Last > Hi) return None;
+        return uint64_t(N);
+    };
+    switch (Unsigned ? ICmpInst::getSignedPredicate(Pred) : Pred) {
+    case ICmpInst::ICMP_SLT:
+        if (*Diff <= 0) return 0;
+        if (Step < 0) return None;
+        return Checked((*Diff - 1) / Step + 1);
+    case ICmpInst::ICMP_SLE:
+        if (*Diff < 0) return 0;
+        if (Step < 0) return None;
+        return Checked(*Diff / Step + 1);
+    case ICmpInst::ICMP_SGT:
+        if (*Diff >= 0) return 0;
+        if (Step > 0) return None;
+        return Checked((*Diff + 1) / Step + 1);
+    case ICmpInst::ICMP_SGE:
+        if (*Diff > 0) return 0;
+        if (Step > 0) return None;
+        return Checked(*Diff / Step + 1);
+    case ICmpInst::ICMP_NE:
+        if (*Diff % Step || *Diff / Step < 0) return None;
+        return uint64_t(*Diff / Step);
+    case ICmpInst::ICMP_EQ:
+        return *Diff == 0 ? 1 : 0;
+    default:
+        return None;
+    }
+}
+
+// Trip count of a loop whose IV lives in memory (-O0 input), which SCEV
+// cannot see: one exiting block, run once per iteration, leaving on
+// "load Ptr <pred> constant", where Ptr is stored a constant before the loop
+// and moved by a constant step once per iteration.
+static Optional<uint64_t> MemoryTripCount(Loop *L, ArrayRef<BasicBlock*> ExitBlocks,
+                                          AnalysisContext &AC){
+    BasicBlock *Latch = L->getLoopLatch();
+    if (ExitBlocks.size() != 1 || !Latch || L->getExitingBlock() != ExitBlocks.front())
+        return None;
+    BasicBlock *Exiting = ExitBlocks.front();
+    if (AC.LI.getLoopFor(Exiting) != L || !AC.DT.dominates(Exiting, Latch)) return None;
+
+    auto *BI = cast<BranchInst>(Exiting->getTerminator());
+    auto *Cmp = dyn_cast<ICmpInst>(BI->getCondition());
+    if (!Cmp) return None;
+    CmpInst::Predicate Pred = Cmp->getPredicate();
+    auto *Load = dyn_cast<LoadInst>(Cmp->getOperand(0));
+    auto *Bound = dyn_cast<ConstantInt>(Cmp->getOperand(1));
+    if (!Load) {
+        Load = dyn_cast<LoadInst>(Cmp->getOperand(1));
+        Bound = dyn_cast<ConstantInt>(Cmp->getOperand(0));
+        Pred = CmpInst::getSwappedPredicate(Pred);
+    }
+    if (!Load || !Bound || Bound->getBitWidth() > 64 || AC.LI.getLoopFor(Load->getParent()) != L)
+        return None;
+    // stay in the loop while Pred holds
+    if (!L->contains(BI->getSuccessor(0))) Pred = CmpInst::getInversePredicate(Pred);
+
+    std::unique_lock<ContextMutex> Guard = AC.lockContext();
+    MemorySSA &MSSA = AC.getMSSA();
+    DenseMap<Value *, Instruction *> Memo;
+    Instruction *Update = FindMemoryIVUpdate(Load, L, MSSA, Memo);
+    Optional<int64_t> Step = Update ? ConstantMemoryStep(Update) : None;
+    if (!Step || AC.LI.getLoopFor(Update->getParent()) != L) return None;
+
+    // the value stored before the loop, the same on every entry edge
+    MemorySSAWalker *Walker = MSSA.getWalker();
+    auto *HeaderPhi = dyn_cast_or_null<MemoryPhi>(MSSA.getMemoryAccess(L->getHeader()));
+    if (!HeaderPhi) return None;
+    MemoryLocation Loc = MemoryLocation::get(Load);
+    ConstantInt *Start = nullptr;
+    for (unsigned i = 0, e = HeaderPhi->getNumIncomingValues(); i != e; ++i) {
+        if (L->contains(HeaderPhi->getIncomingBlock(i))) continue;
+        auto *Def = dyn_cast<MemoryDef>(
+                Walker->getClobberingMemoryAccess(HeaderPhi->getIncomingValue(i), Loc));
+        auto *Store = Def ? dyn_cast_or_null<StoreInst>(Def->getMemoryInst()) : nullptr;
+        auto *C = Store && Store->getPointerOperand() == Load->getPointerOperand()
+                          ? dyn_cast<ConstantInt>(Store->getValueOperand()) : nullptr;
+        if (!C || (Start && Start != C)) return None;
+        Start = C;
+    }
+    if (!Start) return None;
+
+    // a do-while compare loads the value the update just stored
+    bool Signed = !ICmpInst::isUnsigned(Pred);
+    unsigned Bits = Bound->getBitWidth();
+    int64_t V0 = Signed ? Start->getSExtValue() : int64_t(Start->getZExtValue());
+    int64_t B = Signed ? Bound->getSExtValue() : int64_t(Bound->getZExtValue());
+    if (isa<MemoryDef>(Walker->getClobberingMemoryAccess(Load))) {
+        Optional<int64_t> Next = checkedAdd(V0, *Step);
+        if (!Next) return None;
+        V0 = *Next;
+    }
+    Optional<uint64_t> Taken = CountWhile(Pred, V0, *Step, B, Bits);
+    if (!Taken || *Taken == UINT64_MAX) return None;
+    return *Taken + 1;
+}
+
+// Trip counts, counted as LLVM's unroller does: how often the header runs
+// per entry, the backedge-taken count plus one. So an unrotated
+// "for (i = 0; i < 10; i++)" runs its header 11 times, its rotated -O2 form
+// 10. "exact" is a constant count, "max" a constant or symbolic upper bound.
+static void ComputeTripCount(Loop *L, unsigned LoopIndex, ArrayRef<BasicBlock*> ExitBlocks,
+                             AnalysisContext &AC, FunctionResult &R, LoopRecord *Rec){
+    LoopResult &Res = R.LoopResults[LoopIndex];
+    Res.TripKind = "unknown";
+    auto Found = [&](const char *Kind, Optional<uint64_t> Count, std::string Text) {
+        Res.TripKind = Kind;
+        Res.TripCount = Count;
+        if (Rec) {
+            Rec->TripKind = Kind;
+            Rec->TripCount = std::move(Text);
+        }
+    };
+    auto Constant = [](const SCEV *S) -> Optional<uint64_t> {
+        auto *C = dyn_cast<SCEVConstant>(S);
+        if (!C || C->getAPInt().getActiveBits() > 64) return None;
+        return C->getAPInt().getZExtValue();
+    };
+
+    // without header PHIs there is no register IV for SCEV to count
+    if (isa<PHINode>(L->getHeader()->front())) {
+        std::unique_lock<ContextMutex> Guard = AC.lockContext();
+        ScalarEvolution &SE = AC.getSE();
+        const SCEV *Exact = SE.getBackedgeTakenCount(L);
+        if (Optional<uint64_t> Count = Constant(SE.getTripCountFromExitCount(Exact))) {
+            Found("exact", Count, std::to_string(*Count));
+        } else {
+            const SCEV *Max = SE.getConstantMaxBackedgeTakenCount(L);
+            const SCEV *Symbolic = SE.getSymbolicMaxBackedgeTakenCount(L);
+            Optional<uint64_t> Bound;
+            if (!isa<SCEVCouldNotCompute>(Max)) Bound = Constant(SE.getTripCountFromExitCount(Max));
+            if (!isa<SCEVCouldNotCompute>(Symbolic)) {
+                std::string Text;
+                raw_string_ostream(Text) << *SE.getTripCountFromExitCount(Symbolic);
+                Found("max", Bound, Text);
+            } else if (Bound) {
+                Found("max", Bound, std::to_string(*Bound));
+            }
+        }
+    }
+    if (StringRef(Res.TripKind) == "unknown" && StringRef(Res.IVKind) == "memory") {
+        if (Optional<uint64_t> Count = MemoryTripCount(L, ExitBlocks, AC))
+            Found("exact", Count, std::to_string(*Count));
+    }
+
+    if (StringRef(Res.TripKind) == "exact") Count(R, Stat::NumLoopsExactTrip);
+    else if (StringRef(Res.TripKind) == "max") Count(R, Stat::NumLoopsMaxTrip);
+    else Count(R, Stat::NumLoopsUnknownTrip);
+}
+
+// Does nothing in L write memory Load may read?
+static bool IsInvariantLoad(LoadInst *Load, ArrayRef<Instruction *> Writes, AAResults &AA){
+    if (!Load->isSimple()) return false;
+    MemoryLocation Loc = MemoryLocation::get(Load);
+    return none_of(Writes, [&](Instruction *W) { return isModSet(AA.getModRefInfo(W, Loc)); });
+}
+
+// Hoist what is invariant in L to its preheader: instructions that are safe
+// to speculate, and loads nothing in the loop may write to that either
+// cannot trap or run on every iteration anyway. Blocks are visited in
+// reverse postorder so operands move before their users; subloop blocks are
+// left to the subloop, which was done first. Returns how many moved.
+static unsigned HoistLoopInvariants(Loop *L, AnalysisContext &AC, FunctionResult &R){
+    SmallVector<Instruction *, 16> Writes;
+    bool MayStop = false; // something may throw or not return
+    for (BasicBlock *BB : L->blocks()) {
+        for (Instruction &I : *BB) {
+            if (I.mayWriteToMemory()) Writes.push_back(&I);
+            if (!isGuaranteedToTransferExecutionToSuccessor(&I)) MayStop = true;
+        }
+    }
+    SmallVector<BasicBlock *, 4> Exiting;
+    L->getExitingBlocks(Exiting);
+    auto RunsEveryIteration = [&](BasicBlock *BB) {
+        return !MayStop && !Exiting.empty() &&
+               all_of(Exiting, [&](BasicBlock *E) { return AC.DT.dominates(BB, E); });
+    };
+
+    LoopBlocksRPO Blocks(L);
+    Blocks.perform(&AC.LI);
+    BasicBlock *Preheader = L->getLoopPreheader();
+    unsigned Hoisted = 0;
+    for (BasicBlock *BB : Blocks) {
+        if (AC.LI.getLoopFor(BB) != L) continue;
+        for (Instruction &I : make_early_inc_range(*BB)) {
+            if (isa<PHINode>(I) || I.isTerminator() || isa<AllocaInst>(I) ||
+                isa<DbgInfoIntrinsic>(I) || I.mayHaveSideEffects() ||
+                !L->hasLoopInvariantOperands(&I))
+                continue;
+            // what holds on entry to the header holds in a new preheader too
+            Instruction *Ctx = Preheader ? Preheader->getTerminator() : &L->getHeader()->front();
+            bool Speculatable = isSafeToSpeculativelyExecute(&I, Ctx, &AC.DT);
+            if (auto *Load = dyn_cast<LoadInst>(&I)) {
+                if (!IsInvariantLoad(Load, Writes, AC.getAA()) ||
+                    (!Speculatable && !RunsEveryIteration(BB)))
+                    continue;
+            } else if (I.mayReadFromMemory() || !Speculatable) {
+                continue;
+            }
+
+            // created on the first hoist only, like LoopSimplify would
+            if (!Preheader) {
+                Preheader = InsertPreheaderForLoop(L, &AC.DT, &AC.LI, nullptr, false);
+                if (!Preheader) return Hoisted; // counted as CLANoPreheader
+                Count(R, Stat::NumPreheadersInserted);
+                R.Changed = true;
+            }
+            LLVM_DEBUG(dbgs() << "hoisting " << I << "\n");
+            I.moveBefore(Preheader->getTerminator());
+            I.updateLocationAfterHoist();
+            if (isa<LoadInst>(I)) Count(R, Stat::NumHoistedLoads);
+            Hoisted++;
+        }
+    }
+    return Hoisted;
+}
+
+// -licm: runs on the dominator tree and loop info of the analysis, innermost
+// loops first so what they hoist can move on out of the enclosing loop.
+// Preheaders are inserted with LoopSimplify's utility, which keeps both up
+// to date, and only for loops that have something to hoist.
+static void HoistInvariants(AnalysisContext &AC, FunctionResult &R){
+    TimeTraceScope Trace("LICM");
+    SmallVector<Loop *, 8> Loops = AC.LI.getLoopsInPreorder();
+    R.Hoisted.assign(Loops.size(), 0);
+    if (Loops.empty()) return;
+
+    // new blocks and instructions are created in the shared context
+    std::unique_lock<ContextMutex> Guard = AC.lockContext();
+    for (unsigned i = Loops.size(); i-- > 0;) {
+        R.Hoisted[i] = HoistLoopInvariants(Loops[i], AC, R);
+        if (R.Hoisted[i]) R.Changed = true;
+        Count(R, Stat::NumHoisted, R.Hoisted[i]);
+    }
+}
+
+// -static-hotness, per function: how often each loop header and each call
+// to a defined function runs per call, from BlockFrequencyInfo and the trip
+// counts found. The call graph is put together once every function is
+// done, in EstimateLoopWeights.
+static void EstimateFrequencies(AnalysisContext &AC, FunctionResult &R){
+    BlockFrequencyInfo *BFI;
+    {
+        // branch probabilities keep value handles on the blocks
+        std::unique_lock<ContextMutex> Guard = AC.lockContext();
+        BFI = &AC.getBFI();
+    }
+    const BranchProbabilityInfo &BPI = *BFI->getBPI();
+    double Entry = BFI->getEntryFreq();
+    auto Freq = [&](BasicBlock *BB) { return BFI->getBlockFreq(BB).getFrequency() / Entry; };
+
+    // An exact trip count replaces the heuristic one, for the loop and for
+    // everything nested in it. Preorder scales the parent first.
+    SmallVector<Loop *, 8> Loops = AC.LI.getLoopsInPreorder();
+    DenseMap<Loop *, double> Scale;
+    for (unsigned i = 0; i < Loops.size(); ++i) {
+        Loop *L = Loops[i];
+        LoopResult &Res = R.LoopResults[i];
+        double S = L->getParentLoop() ? Scale[L->getParentLoop()] : 1;
+        double Header = Freq(L->getHeader());
+        if (StringRef(Res.TripKind) == "exact") {
+            double Entered = 0;
+            for (BasicBlock *Pred : predecessors(L->getHeader())) {
+                if (L->contains(Pred)) continue;
+                BranchProbability P = BPI.getEdgeProbability(Pred, L->getHeader());
+                Entered += Freq(Pred) * P.getNumerator() / P.getDenominator();
+            }
+            if (Entered > 0 && Header > 0) S *= *Res.TripCount / (Header / Entered);
+        }
+        Scale[L] = S;
+        Res.HeaderFreq = Header * S;
+    }
+
+    MapVector<Function *, double> Calls;
+    for (BasicBlock &BB : *R.F) {
+        Loop *L = AC.LI.getLoopFor(&BB);
+        for (Instruction &I : BB) {
+            auto *Call = dyn_cast<CallBase>(&I);
+            Function *Callee = Call ? Call->getCalledFunction() : nullptr;
+            if (Callee && !Callee->isDeclaration())
+                Calls[Callee] += Freq(&BB) * (L ? Scale[L] : 1);
+        }
+    }
+    for (auto &Entry : Calls) R.Calls.push_back({Entry.first, Entry.second, false});
+}
+
+bool VerifyAnnotations(const std::vector<Function *> &Fns, raw_ostream &OS){
+    if (Fns.empty()) return false;
+    LLVMContext &Ctx = Fns.front()->getContext();
+    unsigned IVUpdate = Ctx.getMDKindID(CLAIVKind);
+
+    bool Broken = false;
+    auto Fail = [&](Function &F, Instruction &I, const char *What){
+        OS << "cla metadata: " << What << " in " << F.getName() << ":\n  " << I << "\n";
+        Broken = true;
+    };
+    for (Function *F : Fns){
+        // the cla.loop nodes of F's loop IDs, which IV updates must point at
+        SmallPtrSet<const MDNode *, 8> Identities;
+        for (BasicBlock &BB : *F){
+            for (Instruction &I : BB){
+                MDNode *ID = I.getMetadata(LLVMContext::MD_loop);
+                if (!ID) continue;
+                bool Malformed;
+                if (ReadLoopID(ID, Malformed)) {
+                    for (const MDOperand &Op : drop_begin(ID->operands())) {
+                        auto *N = dyn_cast_or_null<MDNode>(Op.get());
+                        if (N && ReadLoopNode(N)) Identities.insert(N);
+                    }
+                }
+                if (Malformed)
+                    Fail(*F, I, "malformed cla entry in loop ID");
+                else if (I.getNumSuccessors() == 0)
+                    Fail(*F, I, "loop ID on a non-branch");
+            }
+        }
+        for (BasicBlock &BB : *F){
+            for (Instruction &I : BB){
+                MDNode *N = I.getMetadata(IVUpdate);
+                if (!N) continue;
+                if (!ReadLoopNode(N))
+                    Fail(*F, I, "malformed induction variable loop node");
+                else if (I.isTerminator())
+                    Fail(*F, I, "induction variable update on a terminator");
+                else if (!Identities.count(N))
+                    Fail(*F, I, "induction variable update of a loop without a loop ID");
+            }
+        }
+    }
+    return Broken;
+}
+
+TraversalClient::~TraversalClient() = default;
+
+static std::vector<TraversalClientFactory> &RegisteredClients(){
+    static std::vector<TraversalClientFactory> Factories;
+    return Factories;
+}
+
+void RegisterTraversalClient(TraversalClientFactory Factory){
+    RegisteredClients().push_back(std::move(Factory));
+}
+
+// The one walk over F that every client shares.
+static void TraverseFunction(Function &F, LoopInfo &LI, ArrayRef<TraversalClient *> Clients){
+    for (TraversalClient *C : Clients) C->beginFunction(F, LI);
+    for (BasicBlock &BB : F) {
+        Loop *L = LI.getLoopFor(&BB);
+        for (TraversalClient *C : Clients) C->visitBlock(BB, L);
+        for (Instruction &I : BB) {
+            for (TraversalClient *C : Clients) C->visitInstruction(I, L);
+        }
+    }
+    for (TraversalClient *C : Clients) C->endFunction(F, LI);
+}
+
+// Module summary counters. Counted locally and added once per function to
+// keep the shared statistics out of the per-instruction path.
+class SummaryClient : public TraversalClient {
+public:
+    void beginFunction(Function &, LoopInfo &) override {
+        Instructions = Loads = Stores = 0;
+    }
+
+    void visitInstruction(Instruction &I, Loop *) override {
+        Instructions++;
+        if (isa<LoadInst>(&I)) {
+            Loads++;
+        } else if (isa<StoreInst>(&I)) {
+            Stores++;
+        }
+    }
+
+    void endFunction(Function &, LoopInfo &) override {
+        Count(*R, Stat::Functions);
+        Count(*R, Stat::Instructions, Instructions);
+        Count(*R, Stat::Loads, Loads);
+        Count(*R, Stat::Stores, Stores);
+    }
+
+    FunctionResult *R = nullptr;
+
+private:
+    unsigned Instructions = 0, Loads = 0, Stores = 0;
+};
+
+// What each loop contains. Blocks are counted for their innermost loop
+// during the walk and rolled up into the enclosing loops at the end.
+class LoopShapeClient : public TraversalClient {
+public:
+    explicit LoopShapeClient(const AnalysisRun &Run) : Run(Run) {}
+
+    void beginFunction(Function &, LoopInfo &LI) override {
+        Shapes.clear();
+        // every loop gets its slot up front so Current stays valid
+        for (Loop *L : LI.getLoopsInPreorder()) Shapes[L];
+    }
+
+    void visitBlock(BasicBlock &, Loop *L) override {
+        Current = L ? &Shapes[L] : nullptr;
+        if (Current) Current->Blocks++;
+    }
+
+    void visitInstruction(Instruction &I, Loop *) override {
+        if (!Current) return;
+        Current->Instructions++;
+        if (isa<LoadInst>(&I)) {
+            Current->Loads++;
+        } else if (isa<StoreInst>(&I)) {
+            Current->Stores++;
+        } else if (isa<CallBase>(&I) && !isa<DbgInfoIntrinsic>(&I)) {
+            Current->Calls++;
+        }
+    }
+
+    void endFunction(Function &, LoopInfo &LI) override {
+        SmallVector<Loop *, 8> Loops = LI.getLoopsInPreorder();
+        if (Run.Opts.Records) R->Loops.resize(Loops.size());
+
+        // reverse preorder sees every subloop before its parent
+        for (unsigned i = Loops.size(); i-- > 0;) {
+            Loop *L = Loops[i];
+            LoopShape &S = Shapes[L];
+            if (Loop *Parent = L->getParentLoop()) Shapes[Parent] += S;
+
+            Count(*R, Stat::NumLoops);
+            if (!S.Stores) Count(*R, Stat::NumLoopsNoStore);
+            if (!S.Loads) Count(*R, Stat::NumLoopsNoLoad);
+            if (S.Calls) Count(*R, Stat::NumLoopsWithCall);
+            if (!L->getLoopPreheader()) Count(*R, Stat::CLANoPreheader);
+            R->LoopResults[i].Memory = MemoryClass(S);
+
+            if (Run.Opts.Records) describe(L, i, S, R->Loops[i]);
+        }
+        Current = nullptr;
+    }
+
+    FunctionResult *R = nullptr;
+
+private:
+    static void describe(Loop *L, unsigned Index, const LoopShape &S, LoopRecord &Rec) {
+        Rec.Index = Index;
+        Rec.Depth = L->getLoopDepth();
+        if (DebugLoc DL = L->getStartLoc())
+            Rec.Location = formatv("{0}:{1}", DL->getFilename(), DL.getLine());
+        Rec.Shape = S;
+        Rec.Preheader = L->getLoopPreheader() != nullptr;
+        Rec.Latches = L->getNumBackEdges();
+        SmallVector<BasicBlock *, 4> Blocks;
+        L->getExitingBlocks(Blocks);
+        Rec.Exiting = Blocks.size();
+        Blocks.clear();
+        L->getUniqueExitBlocks(Blocks);
+        Rec.Exits = Blocks.size();
+    }
+
+    const AnalysisRun &Run;
+    DenseMap<Loop *, LoopShape> Shapes;
+    LoopShape *Current = nullptr;
+};
+
+// Annotation candidates. Backedge branches are picked up as the walk passes
+// the latches; induction variable updates need SCEV or MemorySSA and are
+// searched loop by loop once the walk is done.
+class AnnotationClient : public TraversalClient {
+public:
+    AnnotationClient(AnalysisContext &AC, const AnalysisRun &Run) : AC(AC), Run(Run) {}
+
+    FunctionResult *R = nullptr;
+
+    void beginFunction(Function &, LoopInfo &LI) override {
+        Loops = LI.getLoopsInPreorder();
+        Index.clear();
+        // sized before any client's endFunction fills it in
+        R->LoopResults.resize(Loops.size());
+        for (unsigned i = 0; i < Loops.size(); ++i) {
+            Loop *L = Loops[i];
+            LoopResult &Res = R->LoopResults[i];
+            Index[L] = i;
+            Res.Anchor = LoopAnchor(L);
+            SmallVector<BasicBlock *, 4> Latches;
+            L->getLoopLatches(Latches);
+            if (!Latches.empty()) Res.Latch = Latches.front()->getTerminator();
+            // preorder puts the parent first
+            if (Loop *Parent = L->getParentLoop()) Res.Parent = Index.lookup(Parent);
+            Res.Shape = StructuralHash(L);
+        }
+        AssignLoopIds(*R);
+        if (Run.Opts.Profile) {
+            for (unsigned i = 0; i < Loops.size(); ++i)
+                R->LoopResults[i].Exit = ProfiledBranch(Loops[i], R->LoopResults[i].StaySucc);
+        }
+    }
+
+    void visitInstruction(Instruction &I, Loop *L) override {
+        if (!I.isTerminator()) return;
+        // a latch of L or of any loop around it; the innermost one names it
+        for (Loop *Outer = L; Outer; Outer = Outer->getParentLoop()) {
+            if (is_contained(successors(I.getParent()), Outer->getHeader())) {
+                R->Annotations.push_back({&I, BackEdgeAnnotation, Index.lookup(Outer)});
+                break;
+            }
+        }
+    }
+
+    void endFunction(Function &, LoopInfo &) override {
+        for (unsigned i = 0; i < Loops.size(); ++i) {
+            TimeTraceScope Trace("Loop", [&] {
+                BasicBlock *Header = Loops[i]->getHeader();
+                return formatv("{0} {1} depth {2} header {3}", FormatLoopId(R->LoopResults[i].Id),
+                               Header->getParent()->getName(), Loops[i]->getLoopDepth(),
+                               Header->hasName() ? Header->getName() : "<unnamed>").str();
+            });
+            ArrayRef<BasicBlock *> ExitBlocks = getLoopExitBlocks(Loops[i], AC);
+            LoopRecord *Rec = R->Loops.empty() ? nullptr : &R->Loops[i];
+            FindIndVarUpdateCandidates(Loops[i], i, ExitBlocks, AC, *R, Rec);
+            ComputeTripCount(Loops[i], i, ExitBlocks, AC, *R, Rec);
+        }
+    }
+
+private:
+    // Where Loop::getStartLoc looks when there is no llvm.loop location. An
+    // instruction rather than its location, so cached results can name it.
+    static Instruction *LoopAnchor(Loop *L) {
+        if (BasicBlock *Preheader = L->getLoopPreheader()) {
+            if (Preheader->getTerminator()->getDebugLoc()) return Preheader->getTerminator();
+        }
+        Instruction *Term = L->getHeader()->getTerminator();
+        return Term->getDebugLoc() ? Term : nullptr;
+    }
+
+    // The branch the profile counts describe: a conditional latch that can
+    // leave the loop, or, in an unrotated loop, the header when it is the only
+    // exiting block. Per entry it stays in the loop once per backedge and
+    // leaves once (exactly so if it is the only way out).
+    static BranchInst *ProfiledBranch(Loop *L, unsigned &StaySucc) {
+        BasicBlock *Latch = L->getLoopLatch();
+        if (!Latch) return nullptr;
+        auto *BI = dyn_cast<BranchInst>(Latch->getTerminator());
+        if (BI && BI->isUnconditional() && L->getExitingBlock() == L->getHeader())
+            BI = dyn_cast<BranchInst>(L->getHeader()->getTerminator());
+        if (!BI || !BI->isConditional()) return nullptr;
+        bool Stays0 = L->contains(BI->getSuccessor(0));
+        if (Stays0 == L->contains(BI->getSuccessor(1))) return nullptr;
+        StaySucc = Stays0 ? 0 : 1;
+        return BI;
+    }
+
+    // Identifies a loop without debug info: the opcodes of its header, its
+    // size and how many loops it contains.
+    static uint64_t StructuralHash(Loop *L) {
+        SmallVector<uint32_t, 32> Words = {L->getNumBlocks(), unsigned(L->getSubLoops().size())};
+        for (Instruction &I : *L->getHeader()) Words.push_back(I.getOpcode());
+        MD5 H;
+        H.update(makeArrayRef(reinterpret_cast<const uint8_t *>(Words.data()),
+                              Words.size() * sizeof(uint32_t)));
+        MD5::MD5Result Result;
+        H.final(Result);
+        return Result.low();
+    }
+
+    AnalysisContext &AC;
+    const AnalysisRun &Run;
+    SmallVector<Loop *, 8> Loops;
+    DenseMap<Loop *, unsigned> Index;
+};
+
+// Bump whenever the analysis would decide differently on the same IR:
+// cached results of older versions are then simply never found.
+static const char CacheVersion[] = "cla-cache-5";
+
+// Exact structural fingerprint of a function: everything the analysis can
+// observe (CFG, opcodes, types, flags, operand identities, constants and
+// callee declarations), but not value names or debug locations. While
+// hashing, instructions are numbered in function order; the cache refers to
+// them by that number.
+class FunctionHasher {
+public:
+    std::vector<Instruction *> Insts;
+
+    MD5::MD5Result hash(Function &F, bool Annotate) {
+        Insts.clear();
+        Number.clear();
+        Local.clear();
+        Bytes.clear();
+        unsigned Blocks = 0;
+        for (BasicBlock &BB : F) {
+            Number[&BB] = Blocks++;
+            for (Instruction &I : BB) {
+                Number[&I] = Insts.size();
+                Insts.push_back(&I);
+            }
+        }
+
+        add(CacheVersion);
+        add(Annotate ? "annotate" : "summary");
+        add(F.getParent()->getDataLayoutStr());
+        add(F.getParent()->getTargetTriple());
+        // the signature, not the name: renamed copies still hit
+        addType(F.getFunctionType());
+        addAttributes(F.getAttributes());
+
+        for (BasicBlock &BB : F) {
+            add(uint32_t('B'));
+            for (Instruction &I : BB) {
+                add(I.getOpcode() | I.getRawSubclassOptionalData() << 8 |
+                    I.getNumOperands() << 16);
+                addType(I.getType());
+                addDetails(I);
+                for (Value *Op : I.operands()) addOperand(Op);
+            }
+        }
+
+        MD5 H;
+        H.update(Bytes);
+        MD5::MD5Result Result;
+        H.final(Result);
+        return Result;
+    }
+
+private:
+    void add(StringRef S) {
+        add(uint32_t(S.size()));
+        Bytes.append(S.bytes_begin(), S.bytes_end());
+    }
+
+    void add(uint32_t V) {
+        uint8_t Raw[sizeof(V)];
+        memcpy(Raw, &V, sizeof(V));
+        Bytes.append(Raw, Raw + sizeof(V));
+    }
+
+    // Types, constants, globals and attribute lists are spelled out the
+    // first time a function uses them and referred to by number after that.
+    // The numbering also captures which operands are the same value.
+    template <typename DescribeFn>
+    void addShared(const void *Key, DescribeFn Describe) {
+        auto It = Local.insert({Key, Local.size()});
+        add(It.first->second);
+        if (It.second) add(Describe());
+    }
+
+    void addType(Type *T) {
+        addShared(T, [&]() -> StringRef {
+            std::string &Text = Descriptions[T];
+            if (Text.empty()) raw_string_ostream(Text) << *T;
+            return Text;
+        });
+    }
+
+    void addAttributes(AttributeList Attrs) {
+        addShared(Attrs.getRawPointer(), [&]() -> StringRef {
+            std::string &Text = Descriptions[Attrs.getRawPointer()];
+            if (Text.empty()) Text = Attrs.getAsString(AttributeList::FunctionIndex);
+            return Text;
+        });
+    }
+
+    void addDetails(Instruction &I) {
+        if (auto *Cmp = dyn_cast<CmpInst>(&I)) {
+            add(Cmp->getPredicate());
+        } else if (auto *LI = dyn_cast<LoadInst>(&I)) {
+            add(LI->isVolatile() | unsigned(LI->getOrdering()) << 1 | Log2(LI->getAlign()) << 8);
+        } else if (auto *SI = dyn_cast<StoreInst>(&I)) {
+            add(SI->isVolatile() | unsigned(SI->getOrdering()) << 1 | Log2(SI->getAlign()) << 8);
+        } else if (auto *AI = dyn_cast<AllocaInst>(&I)) {
+            addType(AI->getAllocatedType());
+        } else if (auto *GEP = dyn_cast<GetElementPtrInst>(&I)) {
+            addType(GEP->getSourceElementType());
+        } else if (auto *CB = dyn_cast<CallBase>(&I)) {
+            addType(CB->getFunctionType());
+            add(CB->getCallingConv());
+            addAttributes(CB->getAttributes());
+        } else if (auto *PN = dyn_cast<PHINode>(&I)) {
+            for (BasicBlock *In : PN->blocks()) add(Number.lookup(In));
+        }
+    }
+
+    void addOperand(Value *V) {
+        if (isa<Instruction>(V) || isa<BasicBlock>(V)) {
+            add(uint32_t(isa<Instruction>(V) ? 'i' : 'b'));
+            add(Number.lookup(V));
+        } else if (auto *A = dyn_cast<Argument>(V)) {
+            add(uint32_t('a'));
+            add(A->getArgNo());
+        } else {
+            add(uint32_t('v'));
+            addShared(V, [&]() -> StringRef { return describe(V); });
+        }
+    }
+
+    StringRef describe(Value *V) {
+        std::string &Text = Descriptions[V];
+        if (!Text.empty()) return Text;
+
+        raw_string_ostream OS(Text);
+        if (auto *Fn = dyn_cast<Function>(V)) {
+            OS << "fn " << Fn->getName() << ' ' << *Fn->getFunctionType() << ' '
+               << Fn->getAttributes().getAsString(AttributeList::FunctionIndex);
+        } else if (auto *GV = dyn_cast<GlobalValue>(V)) {
+            OS << "gv " << GV->getName() << ' ' << *GV->getValueType();
+        } else if (isa<MetadataAsValue>(V)) {
+            OS << "md";
+        } else {
+            V->print(OS);
+        }
+        OS.flush();
+        return Text;
+    }
+
+    SmallVector<uint8_t, 4096> Bytes;
+    DenseMap<const Value *, unsigned> Number;
+    DenseMap<const void *, unsigned> Local;
+    // Types, values and attribute lists all live as long as the module
+    DenseMap<const void *, std::string> Descriptions;
+};
+
+static std::string CachePath(StringRef CacheDir, const MD5::MD5Result &Key){
+    SmallString<32> Hex = Key.digest();
+    return (Twine(CacheDir) + "/" + Hex.substr(0, 2) + "/" + Hex.substr(2)).str();
+}
+
+// The entry of Names equal to S, so the result outlives the cache file;
+// "" for "-" or anything unknown.
+static const char *InternName(StringRef S, std::initializer_list<const char *> Names){
+    for (const char *Name : Names) {
+        if (S == Name) return Name;
+    }
+    return "";
+}
+
+// Instruction number N of the function, or null for "-".
+static bool ParseInstruction(StringRef N, ArrayRef<Instruction *> Insts, Instruction *&I){
+    uint64_t Number;
+    I = nullptr;
+    if (N == "-") return true;
+    if (N.getAsInteger(10, Number) || Number >= Insts.size()) return false;
+    I = Insts[Number];
+    return true;
+}
+
+// Cached results are text: a header line, "L <anchor> <latch> <parent>
+// <shape> <iv kind> <iv step> <memory> <trip kind> <trip count>" per loop
+// ("-" for an empty field; anchor and latch are instruction numbers, the
+// shape is hex), "A <kind> <instruction number> <loop>" per annotation and
+// "S <statistic> <value>" per non-zero counter.
+
+static bool LoadCachedResult(StringRef CacheDir, const MD5::MD5Result &Key,
+                             ArrayRef<Instruction *> Insts, FunctionResult &R){
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Buf = MemoryBuffer::getFile(CachePath(CacheDir, Key));
+    if (!Buf) return false;
+
+    SmallVector<StringRef, 64> Lines;
+    (*Buf)->getBuffer().split(Lines, '\n', -1, false);
+    if (Lines.empty() || Lines[0] != CacheVersion) return false;
+
+    FunctionResult Cached;
+    for (StringRef Line : makeArrayRef(Lines).drop_front()) {
+        SmallVector<StringRef, 10> Fields;
+        Line.split(Fields, ' ');
+        uint64_t A, B, C;
+        if (Fields.size() == 10 && Fields[0] == "L") {
+            LoopResult Loop;
+            if (!ParseInstruction(Fields[1], Insts, Loop.Anchor) ||
+                !ParseInstruction(Fields[2], Insts, Loop.Latch) ||
+                Fields[3].getAsInteger(10, Loop.Parent) ||
+                Loop.Parent >= int(Cached.LoopResults.size()) ||
+                Fields[4].getAsInteger(16, Loop.Shape))
+                return false;
+            Loop.IVKind = InternName(Fields[5], {"scev", "memory"});
+            if (Fields[6] != "-") {
+                int64_t Step;
+                if (Fields[6].getAsInteger(10, Step)) return false;
+                Loop.IVStep = Step;
+            }
+            Loop.Memory = InternName(Fields[7], {"readnone", "readonly", "writeonly",
+                                                 "readwrite", "unknown"});
+            Loop.TripKind = InternName(Fields[8], {"exact", "max", "unknown"});
+            if (Fields[9] != "-") {
+                uint64_t Trip;
+                if (Fields[9].getAsInteger(10, Trip)) return false;
+                Loop.TripCount = Trip;
+            }
+            Cached.LoopResults.push_back(Loop);
+        } else if (Fields.size() == 4 && Fields[0] == "A") {
+            if (Fields[1].getAsInteger(10, A) || A > BackEdgeAnnotation ||
+                Fields[2].getAsInteger(10, B) || B >= Insts.size() ||
+                Fields[3].getAsInteger(10, C) || C >= Cached.LoopResults.size())
+                return false;
+            Cached.Annotations.push_back({Insts[B], AnnotationKind(A), unsigned(C)});
+        } else if (Fields.size() == 3 && Fields[0] == "S") {
+            if (Fields[2].getAsInteger(10, B)) return false;
+            Optional<Stat> S = LookupStat(Fields[1]);
+            if (!S) return false;
+            Cached.Counts[unsigned(*S)] = B;
+        } else {
+            return false;
+        }
+    }
+    R.Annotations = std::move(Cached.Annotations);
+    R.LoopResults = std::move(Cached.LoopResults);
+    R.Counts = Cached.Counts;
+    return true;
+}
+
+static void StoreCachedResult(StringRef CacheDir, const MD5::MD5Result &Key,
+                              ArrayRef<Instruction *> Insts, const FunctionResult &R){
+    DenseMap<Instruction *, unsigned> Index;
+    for (unsigned i = 0; i < Insts.size(); ++i) Index[Insts[i]] = i;
+
+    std::string Text = std::string(CacheVersion) + "\n";
+    auto Field = [](StringRef S) { return S.empty() ? StringRef("-") : S; };
+    auto Number = [&](Instruction *I) { return I ? std::to_string(Index.lookup(I)) : "-"; };
+    for (const LoopResult &Loop : R.LoopResults) {
+        Text += formatv("L {0} {1} {2} {3:x-} {4} {5} {6} {7} {8}\n", Number(Loop.Anchor),
+                        Number(Loop.Latch), Loop.Parent, Loop.Shape, Field(Loop.IVKind),
+                        Loop.IVStep ? std::to_string(*Loop.IVStep) : "-", Field(Loop.Memory),
+                        Field(Loop.TripKind),
+                        Loop.TripCount ? std::to_string(*Loop.TripCount) : "-");
+    }
+    for (const Annotation &A : R.Annotations)
+        Text += formatv("A {0} {1} {2}\n", unsigned(A.Kind), Index.lookup(A.I), A.Loop);
+    for (unsigned i = 0; i < NumStats; ++i) {
+        if (R.Counts[i]) Text += formatv("S {0} {1}\n", StatName(Stat(i)), R.Counts[i]);
+    }
+
+    // write then rename, so concurrent cla processes never see half a file
+    std::string Path = CachePath(CacheDir, Key);
+    sys::fs::create_directories(sys::path::parent_path(Path));
+    SmallString<128> Tmp;
+    int FD;
+    if (sys::fs::createUniqueFile(Path + ".tmp%%%%%%", FD, Tmp)) return;
+    {
+        raw_fd_ostream OS(FD, true);
+        OS << Text;
+    }
+    if (sys::fs::rename(Tmp, Path)) sys::fs::remove(Tmp);
+}
+
+// Everything one thread needs to analyze functions: the reusable analysis
+// state plus the built-in and registered traversal clients.
+class AnalysisWorker {
+public:
+    explicit AnalysisWorker(const AnalysisRun &Run, ContextMutex *ContextLock = nullptr)
+        : Run(Run), AC(ContextLock), Shapes(Run), Annotations(AC, Run) {
+        for (TraversalClientFactory &Make : RegisteredClients())
+            Registered.push_back(Make());
+    }
+
+    // Pure analysis: reads F only, so distinct functions may run concurrently.
+    void run(Function &F, FunctionResult &R, bool Annotate) {
+        TimeTraceScope Trace("Function", F.getName());
+        const AnalysisOptions &Opts = Run.Opts;
+        std::chrono::steady_clock::time_point Start;
+        if (Opts.FunctionTimes) Start = std::chrono::steady_clock::now();
+
+        R.F = &F;
+
+        // records and registered clients need the real walk; hoisting
+        // changes the function the cached results would refer to, and the
+        // profiled branches and frequencies are not cached
+        bool UseCache = !Opts.CacheDir.empty() && !Opts.Records && Registered.empty() &&
+                        !Opts.Hoist && !Opts.Profile && !Opts.StaticHotness;
+        MD5::MD5Result Key;
+        if (UseCache) {
+            Key = Hasher.hash(F, Annotate);
+            if (LoadCachedResult(Opts.CacheDir, Key, Hasher.Insts, R)) {
+                AssignLoopIds(R);
+                AddStat(Stat::CacheHits);
+                finish(R, Start);
+                return;
+            }
+            AddStat(Stat::CacheMisses);
+        }
+
+        AC.analyze(F); // dominance and loop info for Function, F
+        if (Annotate && Opts.Hoist) HoistInvariants(AC, R);
+
+        SmallVector<TraversalClient *, 8> Clients = {&Summary};
+        Summary.R = &R;
+        if (Annotate) {
+            Shapes.R = &R;
+            Annotations.R = &R;
+            Clients.push_back(&Shapes);
+            Clients.push_back(&Annotations);
+        }
+        for (std::unique_ptr<TraversalClient> &C : Registered)
+            Clients.push_back(C.get());
+        TraverseFunction(F, AC.LI, Clients);
+        if (Annotate && Opts.StaticHotness) EstimateFrequencies(AC, R);
+
+        if (UseCache) StoreCachedResult(Opts.CacheDir, Key, Hasher.Insts, R);
+        finish(R, Start);
+    }
+
+    void release() { AC.release(); }
+
+private:
+    void finish(FunctionResult &R, std::chrono::steady_clock::time_point Start) {
+        for (unsigned i = 0; i < NumStats; ++i) {
+            if (R.Counts[i]) AddStat(Stat(i), R.Counts[i]);
+        }
+        if (Run.Opts.FunctionTimes)
+            R.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+    }
+
+    const AnalysisRun &Run;
+    AnalysisContext AC;
+    FunctionHasher Hasher;
+    SummaryClient Summary;
+    LoopShapeClient Shapes;
+    AnnotationClient Annotations;
+    std::vector<std::unique_ptr<TraversalClient>> Registered;
+};
+
+// -static-hotness, for the module: how often each function runs per
+// program run, and so each loop's weight, its estimated header runs. main
+// runs once; so does every function whose address is taken (and without a
+// main, every externally visible one), on top of its calls. Calls are
+// followed top-down from there. A call that closes a cycle is not, so
+// recursion counts once.
+static void EstimateLoopWeights(AnalysisRun &Run, Module &M,
+                                std::vector<FunctionResult> &Results){
+    TimeTraceScope Trace("LoopWeights");
+    DenseMap<Function *, FunctionResult *> ResultFor;
+    for (FunctionResult &R : Results) ResultFor[R.F] = &R;
+    Function *Main = M.getFunction("main");
+    bool HasMain = Main && !Main->isDeclaration();
+    auto IsRoot = [&](Function *F) {
+        return F == Main || F->hasAddressTaken() || (!HasMain && !F->hasLocalLinkage());
+    };
+
+    // depth-first from the roots, then from everything else, in module order
+    std::vector<FunctionResult *> PostOrder;
+    DenseMap<FunctionResult *, bool> OnStack; // false once finished
+    SmallVector<std::pair<FunctionResult *, unsigned>, 16> Stack;
+    auto Visit = [&](FunctionResult *Start) {
+        if (!OnStack.insert({Start, true}).second) return;
+        Stack.push_back({Start, 0});
+        while (!Stack.empty()) {
+            FunctionResult *R = Stack.back().first;
+            unsigned Next = Stack.back().second++;
+            if (Next == R->Calls.size()) {
+                OnStack[R] = false;
+                PostOrder.push_back(R);
+                Stack.pop_back();
+                continue;
+            }
+            FunctionResult *Callee = ResultFor.lookup(R->Calls[Next].Callee);
+            if (!Callee) continue;
+            auto Seen = OnStack.insert({Callee, true});
+            if (Seen.second)
+                Stack.push_back({Callee, 0});
+            else if (Seen.first->second)
+                R->Calls[Next].Recursive = true;
+        }
+    };
+    for (FunctionResult &R : Results)
+        if (IsRoot(R.F)) Visit(&R);
+    for (FunctionResult &R : Results) Visit(&R);
+
+    // every caller comes before its callees, recursive calls aside
+    for (FunctionResult *R : reverse(PostOrder)) {
+        if (IsRoot(R->F)) R->Runs += 1;
+        for (const CallEstimate &Call : R->Calls) {
+            FunctionResult *Callee = ResultFor.lookup(Call.Callee);
+            if (Callee && !Call.Recursive) Callee->Runs += R->Runs * Call.Freq;
+        }
+    }
+
+    std::vector<uint64_t> Weights;
+    for (FunctionResult &R : Results) {
+        for (LoopResult &Loop : R.LoopResults) {
+            Loop.Weight = uint64_t(std::min(R.Runs * Loop.HeaderFreq, 1e18) + 0.5);
+            Weights.push_back(Loop.Weight);
+        }
+    }
+    Run.HotWeight = HotCutoff(Weights);
+    uint64_t Total = 0;
+    for (uint64_t W : Weights) Total = SaturatingAdd(Total, W);
+    AddStat(Stat::StaticLoopWeight, Total);
+}
+
+// -use-profile: the loop's counts and heat go into its ID, and the counts
+// become branch weights on its profiled branch.
+static void ApplyProfile(const AnalysisRun &Run, LLVMContext &Ctx, const LoopResult &Loop,
+                         CLALoopProperties &P){
+    const CLALoopCounts *C = Run.counts(Loop.Id);
+    if (!C) {
+        AddStat(Stat::NumLoopsNotProfiled);
+        return;
+    }
+    P.Heat = Run.heat(*C);
+    P.Iterations = C->Headers;
+    P.Entries = C->entries();
+    AddStat(P.Heat == "hot" ? Stat::NumHotLoops : Stat::NumColdLoops);
+    if (!Loop.Exit || !C->Headers) return;
+
+    // branch weights are 32 bits wide
+    uint64_t Scale = std::max(C->Backedges, C->entries()) / UINT32_MAX + 1;
+    uint32_t Weights[2];
+    Weights[Loop.StaySucc] = C->Backedges / Scale;
+    Weights[1 - Loop.StaySucc] = C->entries() / Scale;
+    Loop.Exit->setMetadata(LLVMContext::MD_prof,
+                           MDBuilder(Ctx).createBranchWeights(Weights[0], Weights[1]));
+    AddStat(Stat::NumBranchesWeighted);
+}
+
+static void CommitFunctionResult(const AnalysisRun &Run, LLVMContext &Ctx, FunctionResult &R){
+    const AnalysisOptions &Opts = Run.Opts;
+    if (Opts.Records) WriteLoopRecords(Run, R);
+    if (Opts.FunctionTimes) Opts.FunctionTimes->emplace_back(R.F->getName().str(), R.Seconds);
+    if (Opts.Modified && (R.Changed || !R.Annotations.empty())) Opts.Modified->push_back(R.F);
+
+    if (R.Annotations.empty()) return;
+    unsigned IVUpdate = Ctx.getMDKindID(CLAIVKind);
+    // one identity node per loop, shared by its loop ID and IV updates
+    SmallVector<MDNode *, 8> Nodes(R.LoopResults.size());
+    SmallVector<SmallVector<Instruction *, 2>, 8> Latches(R.LoopResults.size());
+    auto NodeFor = [&](unsigned Loop) {
+        MDNode *&N = Nodes[Loop];
+        if (!N) {
+            N = GetLoopNode(Ctx, R.LoopResults[Loop].Id, R.LoopResults[Loop].Start);
+        }
+        return N;
+    };
+    for (Annotation &A : R.Annotations){
+        if (A.Kind == IVUpdateAnnotation)
+            A.I->setMetadata(IVUpdate, NodeFor(A.Loop));
+        else
+            Latches[A.Loop].push_back(A.I);
+    }
+
+    for (unsigned i = 0; i < Latches.size(); ++i){
+        if (Latches[i].empty()) continue;
+        const LoopResult &Loop = R.LoopResults[i];
+        CLALoopProperties P;
+        P.IVKind = Loop.IVKind;
+        P.IVStep = Loop.IVStep;
+        P.Memory = Loop.Memory;
+        P.TripKind = Loop.TripKind;
+        P.TripCount = Loop.TripCount;
+        if (Opts.Profile) ApplyProfile(Run, Ctx, Loop, P);
+        if (Opts.StaticHotness) {
+            P.EstimatedHeat = Run.estimatedHeat(Loop);
+            P.Weight = Loop.Weight;
+            AddStat(P.EstimatedHeat == "hot" ? Stat::NumStaticHotLoops
+                                             : Stat::NumStaticColdLoops);
+        }
+        // merged into the hints the first latch carries, as Loop::setLoopID
+        // would expect every latch to agree
+        MDNode *Orig = Latches[i].front()->getMetadata(LLVMContext::MD_loop);
+        MDNode *ID = GetLoopID(Ctx, Orig, NodeFor(i), P);
+        for (Instruction *Latch : Latches[i]) Latch->setMetadata(LLVMContext::MD_loop, ID);
+    }
+}
+
+void RunWorkers(ThreadPool &Pool, unsigned NumWorkers, function_ref<void(unsigned)> Task,
+                function_ref<void(unsigned)> Recover){
+    std::atomic<bool> Crashed(false);
+    for (unsigned w = 0; w < NumWorkers; ++w){
+        Pool.async([&, w]{
+            CrashRecoveryContext CRC;
+            if (CRC.RunSafely([&]{ Task(w); })) return;
+            if (Recover) Recover(w);
+            Crashed = true;
+        });
+    }
+    Pool.wait();
+    if (!Crashed) return;
+
+    // only reachable with crash recovery enabled; fail the caller the same way
+    if (CrashRecoveryContext *CRC = CrashRecoveryContext::GetCurrent())
+        CRC->HandleExit(70);
+    report_fatal_error("a worker thread crashed");
+}
+
+static void RunAnalysis(Module *M, unsigned Threads, const AnalysisOptions &Options,
+                        bool Annotate){
+    LLVMContext &Context = M->getContext();
+    AnalysisRun Run(Options);
+
+    std::vector<Function *> Worklist;
+    for (Module::iterator func = M->begin(); func != M->end(); ++func){
+        // for empty function, stop considering
+        if (func->begin() == func->end()){
+            continue;
+        }
+        Worklist.push_back(&*func);
+    }
+
+    std::vector<FunctionResult> Results(Worklist.size());
+    if (Threads == 1 || Worklist.size() < 2){
+        AnalysisWorker W(Run);
+        for (size_t i = 0; i < Worklist.size(); ++i){
+            W.run(*Worklist[i], Results[i], Annotate);
+        }
+    } else {
+        // one worker state per thread; threads pull the next function index
+        ThreadPoolStrategy Strategy = hardware_concurrency(Threads);
+        Optional<ThreadPool> OwnPool;
+        if (!Options.Pool) OwnPool.emplace(Strategy);
+        ThreadPool &Pool = Options.Pool ? *Options.Pool : *OwnPool;
+        unsigned NumWorkers = std::min<size_t>(
+            std::min(Strategy.compute_thread_count(), Pool.getThreadCount()), Worklist.size());
+        std::atomic<size_t> Next(0);
+        ContextMutex ContextLock;
+        std::vector<std::unique_ptr<AnalysisWorker>> Workers;
+        for (unsigned w = 0; w < NumWorkers; ++w){
+            Workers.emplace_back(new AnalysisWorker(Run, &ContextLock));
+        }
+        // with -trace, every worker records on a track of its own
+        bool Trace = timeTraceProfilerEnabled();
+        RunWorkers(Pool, NumWorkers, [&](unsigned w){
+            if (Trace) timeTraceProfilerInitialize(0, "cla");
+            for (size_t i = Next++; i < Worklist.size(); i = Next++){
+                Workers[w]->run(*Worklist[i], Results[i], Annotate);
+            }
+            if (Trace) timeTraceProfilerFinishThread();
+        }, [&](unsigned){
+            ContextLock.releaseIfHeld();
+            // the request fails, its half-written trace with it
+            if (Trace) timeTraceProfilerCleanup();
+        });
+    }
+
+    if (Annotate && Options.StaticHotness) EstimateLoopWeights(Run, *M, Results);
+
+    // metadata creation touches the shared LLVMContext, keep it serial and
+    // in module order
+    TimeTraceScope Trace("Commit");
+    for (FunctionResult &R : Results){
+        CommitFunctionResult(Run, Context, R);
+    }
+}
+
+void CustomLoopAnalysis(Module *M, unsigned Threads, const AnalysisOptions &Options){
+    RunAnalysis(M, Threads, Options, true);
+}
+
+void summarize(Module *M) {
+    RunAnalysis(M, 1, AnalysisOptions(), false);
+}
+
+FunctionStreamAnalysis::FunctionStreamAnalysis(const AnalysisOptions &Options)
+    : Run(new AnalysisRun(Options)), Worker(new AnalysisWorker(*Run)) {}
+
+FunctionStreamAnalysis::~FunctionStreamAnalysis() = default;
+
+void FunctionStreamAnalysis::run(Function &F, bool Annotate){
+    if (F.begin() == F.end()) return;
+
+    FunctionResult R;
+    Worker->run(F, R, Annotate);
+    CommitFunctionResult(*Run, F.getContext(), R);
+
+    // F's body is about to go away; nothing may keep pointing into it
+    Worker->release();
+}
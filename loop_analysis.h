@@ -0,0 +1,157 @@
+#ifndef CLA_LOOP_ANALYSIS_H
+#define CLA_LOOP_ANALYSIS_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/STLFunctionalExtras.h"
+
+#include "cla_profile.h"
+
+namespace llvm {
+class BasicBlock;
+class Function;
+class Instruction;
+class Loop;
+class LoopInfo;
+class Module;
+class raw_ostream;
+class ThreadPool;
+}
+
+class AnalysisRun;
+class AnalysisWorker;
+
+enum class LoopRecordFormat { JSONLines, CSV };
+
+// The settings of one analysis run. Everything is off by default; the
+// pointers must outlive the run. The analysis keeps nothing between runs,
+// so callers such as cla -serve can give every request its own.
+struct AnalysisOptions {
+    // Stream one record per analyzed loop to Records (null turns it off):
+    // loop id, function, file:line, nesting depth, block/instruction/load/
+    // store/call counts, preheader/latch/exit shape and the induction
+    // variable found. Records are written in module order as each function
+    // is committed; see WriteLoopRecordHeader for the CSV header row.
+    llvm::raw_ostream *Records = nullptr;
+    LoopRecordFormat RecordFormat = LoopRecordFormat::JSONLines;
+
+    // Keep per-function analysis results in CacheDir (empty turns it off),
+    // keyed by an exact structural hash of the function plus the analysis
+    // version, so a function that reaches cla unchanged is annotated
+    // straight from the cache. Bypassed while loop records are written or
+    // traversal clients are registered, since both need the real walk.
+    std::string CacheDir;
+
+    // Before annotating a function, move loop-invariant code into loop
+    // preheaders (inserting them where missing), innermost loops first; the
+    // analysis then describes the transformed loops. Bypasses the cache.
+    bool Hoist = false;
+
+    // Annotate with the loop counts in Profile (null turns it off), matched
+    // on loop id: each loop found there is tagged hot or cold in its ID, and
+    // its exiting latch, or the header of an unrotated loop, gets branch
+    // weights. Bypasses the cache.
+    const CLAProfile *Profile = nullptr;
+
+    // Without a profile, estimate how often each loop header runs per
+    // program run: BlockFrequencyInfo within functions, and call
+    // frequencies propagated from main through the call graph. Loops are
+    // tagged hot or cold with the estimate in their ID (cla.est) and the
+    // records. Bypasses the cache; CustomLoopAnalysis only.
+    bool StaticHotness = false;
+
+    // If set, the wall time spent analyzing each function is appended as
+    // (name, seconds), in module order.
+    std::vector<std::pair<std::string, double>> *FunctionTimes = nullptr;
+
+    // If set, every function the analysis attached metadata to is appended,
+    // in module order.
+    std::vector<llvm::Function *> *Modified = nullptr;
+
+    // Run the worker threads on Pool instead of starting a pool for this
+    // run, so a resident caller such as cla -serve keeps its threads warm
+    // from one module to the next. CustomLoopAnalysis still uses no more
+    // than its Threads argument allows.
+    llvm::ThreadPool *Pool = nullptr;
+};
+
+// Annotate every loop in M: backedge branches and the induction variable
+// update feeding the exit condition get the loop's node attached (see
+// cla_metadata.h for the schema). The module
+// summary counters are collected in the same walk, so there is no need to
+// call summarize() afterwards. Functions are
+// analyzed on Threads worker threads (0 means one per core); the metadata
+// is always attached serially in module order.
+void CustomLoopAnalysis(llvm::Module *M, unsigned Threads = 1,
+                        const AnalysisOptions &Options = AnalysisOptions());
+
+// Run Task(0) .. Task(NumWorkers - 1) side by side on Pool and wait for
+// them. With crash recovery enabled (cla -serve), a task that crashes is
+// stopped on its own thread and Recover runs there in its place; once the
+// other tasks are done the crash is passed on to the caller's recovery
+// context, and Pool stays usable for the next request.
+void RunWorkers(llvm::ThreadPool &Pool, unsigned NumWorkers,
+                llvm::function_ref<void(unsigned)> Task,
+                llvm::function_ref<void(unsigned)> Recover = {});
+
+// Collect module-wide instruction counts into the statistics, without
+// annotating anything.
+void summarize(llvm::Module *M);
+
+// An analysis riding along on the single walk CustomLoopAnalysis and
+// summarize make over every function: blocks in function order, each
+// instruction in block order, with the innermost loop containing it (null
+// outside loops). Callbacks run on the analysis worker threads; every worker
+// has its own client instance.
+class TraversalClient {
+public:
+    virtual ~TraversalClient();
+    virtual void beginFunction(llvm::Function & /*F*/, llvm::LoopInfo & /*LI*/) {}
+    virtual void visitBlock(llvm::BasicBlock & /*BB*/, llvm::Loop * /*L*/) {}
+    virtual void visitInstruction(llvm::Instruction & /*I*/, llvm::Loop * /*L*/) {}
+    virtual void endFunction(llvm::Function & /*F*/, llvm::LoopInfo & /*LI*/) {}
+};
+
+typedef std::function<std::unique_ptr<TraversalClient>()> TraversalClientFactory;
+
+// Drive a client made by Factory in every later walk. Register before the
+// first CustomLoopAnalysis call.
+void RegisterTraversalClient(TraversalClientFactory Factory);
+
+// Annotates and summarizes functions one at a time, for callers that
+// materialize function bodies lazily and drop them again afterwards. Keeps
+// one set of analysis state alive across calls.
+class FunctionStreamAnalysis {
+public:
+    explicit FunctionStreamAnalysis(const AnalysisOptions &Options = AnalysisOptions());
+    ~FunctionStreamAnalysis();
+
+    // Same as CustomLoopAnalysis plus summarize, restricted to F.
+    void run(llvm::Function &F, bool Annotate = true);
+
+private:
+    std::unique_ptr<AnalysisRun> Run;
+    std::unique_ptr<AnalysisWorker> Worker;
+};
+
+// The header row a CSV loop record stream starts with; nothing for JSON
+// lines.
+void WriteLoopRecordHeader(llvm::raw_ostream &OS, LoopRecordFormat Format);
+
+// Check cla's metadata in Fns against the layout in cla_metadata.h: every
+// loop ID with cla.* entries has exactly one cla.loop identity, each entry
+// is shaped as documented, and the ID sits on a branch; every !cla.iv
+// attachment is an identity node shared with a loop ID in the same
+// function, on a non-terminator. Problems are described on OS.
+// Returns true if any was found, like llvm::verifyFunction.
+bool VerifyAnnotations(const std::vector<llvm::Function *> &Fns, llvm::raw_ostream &OS);
+
+// Dump the statistics of the current StatsScope (cla_stats.h) to statsfile,
+// name,value per line; cla names it <output>.stats.
+void print_csv_file(std::string statsfile);
+
+#endif // CLA_LOOP_ANALYSIS_H
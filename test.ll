@@ -0,0 +1,105 @@
+; ModuleID = 'test.c'
+; clang -O0 -Xclang -disable-O0-optnone -g -emit-llvm -S -o test.ll test.c
+source_filename = "test.c"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+define dso_local i32 @main() #0 !dbg !7 {
+entry:
+  %retval = alloca i32, align 4
+  %sum = alloca i32, align 4
+  %i = alloca i32, align 4
+  %j = alloca i32, align 4
+  store i32 0, i32* %retval, align 4
+  store i32 0, i32* %sum, align 4, !dbg !12
+  store i32 0, i32* %i, align 4, !dbg !13
+  br label %for.cond, !dbg !14
+
+for.cond:                                         ; preds = %for.inc, %entry
+  %0 = load i32, i32* %i, align 4, !dbg !15
+  %cmp = icmp slt i32 %0, 10, !dbg !16
+  br i1 %cmp, label %for.body, label %for.end, !dbg !17
+
+for.body:                                         ; preds = %for.cond
+  %1 = load i32, i32* %i, align 4, !dbg !18
+  %2 = load i32, i32* %sum, align 4, !dbg !19
+  %add = add nsw i32 %2, %1, !dbg !19
+  store i32 %add, i32* %sum, align 4, !dbg !19
+  br label %for.inc, !dbg !20
+
+for.inc:                                          ; preds = %for.body
+  %3 = load i32, i32* %i, align 4, !dbg !21
+  %inc = add nsw i32 %3, 1, !dbg !21
+  store i32 %inc, i32* %i, align 4, !dbg !21
+  br label %for.cond, !dbg !22, !llvm.loop !23
+
+for.end:                                          ; preds = %for.cond
+  store i32 10, i32* %j, align 4, !dbg !25
+  br label %for.cond1, !dbg !26
+
+for.cond1:                                        ; preds = %for.inc4, %for.end
+  %4 = load i32, i32* %j, align 4, !dbg !27
+  %cmp2 = icmp sge i32 %4, 0, !dbg !28
+  br i1 %cmp2, label %for.body3, label %for.end5, !dbg !29
+
+for.body3:                                        ; preds = %for.cond1
+  %5 = load i32, i32* %j, align 4, !dbg !30
+  %6 = load i32, i32* %sum, align 4, !dbg !31
+  %sub = sub nsw i32 %6, %5, !dbg !31
+  store i32 %sub, i32* %sum, align 4, !dbg !31
+  br label %for.inc4, !dbg !32
+
+for.inc4:                                         ; preds = %for.body3
+  %7 = load i32, i32* %j, align 4, !dbg !33
+  %dec = add nsw i32 %7, -1, !dbg !33
+  store i32 %dec, i32* %j, align 4, !dbg !33
+  br label %for.cond1, !dbg !34, !llvm.loop !35
+
+for.end5:                                         ; preds = %for.cond1
+  ret i32 0, !dbg !36
+}
+
+attributes #0 = { noinline nounwind uwtable }
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4, !5}
+!llvm.ident = !{!6}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C89, file: !1, producer: "clang version 14.0.6", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug, enums: !2, splitDebugInlining: false, nameTableKind: None)
+!1 = !DIFile(filename: "test.c", directory: "/ece566")
+!2 = !{}
+!3 = !{i32 7, !"Dwarf Version", i32 5}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = !{i32 1, !"wchar_size", i32 4}
+!6 = !{!"clang version 14.0.6"}
+!7 = distinct !DISubprogram(name: "main", scope: !1, file: !1, line: 3, type: !8, scopeLine: 3, spFlags: DISPFlagDefinition, unit: !0, retainedNodes: !2)
+!8 = !DISubroutineType(types: !9)
+!9 = !{!10}
+!10 = !DIBasicType(name: "int", size: 32, encoding: DW_ATE_signed)
+!11 = distinct !DILexicalBlock(scope: !7, file: !1, line: 5, column: 5)
+!12 = !DILocation(line: 4, column: 9, scope: !7)
+!13 = !DILocation(line: 5, column: 14, scope: !11)
+!14 = !DILocation(line: 5, column: 10, scope: !11)
+!15 = !DILocation(line: 5, column: 19, scope: !11)
+!16 = !DILocation(line: 5, column: 21, scope: !11)
+!17 = !DILocation(line: 5, column: 5, scope: !11)
+!18 = !DILocation(line: 6, column: 16, scope: !11)
+!19 = !DILocation(line: 6, column: 13, scope: !11)
+!20 = !DILocation(line: 7, column: 5, scope: !11)
+!21 = !DILocation(line: 5, column: 28, scope: !11)
+!22 = !DILocation(line: 5, column: 5, scope: !11)
+!23 = distinct !{!23, !17, !20, !24}
+!24 = !{!"llvm.loop.mustprogress"}
+!25 = !DILocation(line: 9, column: 14, scope: !37)
+!26 = !DILocation(line: 9, column: 10, scope: !37)
+!27 = !DILocation(line: 9, column: 20, scope: !37)
+!28 = !DILocation(line: 9, column: 22, scope: !37)
+!29 = !DILocation(line: 9, column: 5, scope: !37)
+!30 = !DILocation(line: 10, column: 16, scope: !37)
+!31 = !DILocation(line: 10, column: 13, scope: !37)
+!32 = !DILocation(line: 11, column: 5, scope: !37)
+!33 = !DILocation(line: 9, column: 29, scope: !37)
+!34 = !DILocation(line: 9, column: 5, scope: !37)
+!35 = distinct !{!35, !29, !32, !24}
+!36 = !DILocation(line: 13, column: 5, scope: !7)
+!37 = distinct !DILexicalBlock(scope: !7, file: !1, line: 9, column: 5)
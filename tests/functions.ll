@@ -0,0 +1,75 @@
+; Several functions with loops, so that cla -j really spreads them over
+; worker threads.
+
+define i32 @sum(i32* %a, i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %loop ]
+  %s = phi i32 [ 0, %entry ], [ %add, %loop ]
+  %p = getelementptr inbounds i32, i32* %a, i32 %i
+  %v = load i32, i32* %p
+  %add = add nsw i32 %s, %v
+  %inc = add nsw i32 %i, 1
+  %c = icmp slt i32 %inc, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i32 %add
+}
+
+define void @clear(i32* %m) {
+entry:
+  br label %outer
+
+outer:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %outer.latch ]
+  br label %inner
+
+inner:
+  %j = phi i64 [ 0, %outer ], [ %j.next, %inner ]
+  %row = mul nuw nsw i64 %i, 16
+  %idx = add nuw nsw i64 %row, %j
+  %p = getelementptr inbounds i32, i32* %m, i64 %idx
+  store i32 0, i32* %p
+  %j.next = add nuw nsw i64 %j, 1
+  %j.done = icmp eq i64 %j.next, 16
+  br i1 %j.done, label %outer.latch, label %inner
+
+outer.latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %i.done = icmp eq i64 %i.next, 8
+  br i1 %i.done, label %exit, label %outer
+
+exit:
+  ret void
+}
+
+define i32 @countdown() {
+entry:
+  %k = alloca i32
+  store i32 100, i32* %k
+  br label %cond
+
+cond:
+  %v = load i32, i32* %k
+  %c = icmp sgt i32 %v, 0
+  br i1 %c, label %body, label %exit
+
+body:
+  %w = load i32, i32* %k
+  %dec = add nsw i32 %w, -3
+  store i32 %dec, i32* %k
+  br label %cond
+
+exit:
+  %r = load i32, i32* %k
+  ret i32 %r
+}
+
+define i32 @straight(i32 %x) {
+entry:
+  %y = mul i32 %x, 3
+  ret i32 %y
+}
@@ -0,0 +1,61 @@
+; -static-hotness without a profile: main runs once, so its loop header
+; runs 10 times and calls @work 10 times; @work's loop header runs 100 times
+; per call, 1000 in all. @rare runs once, 3 header runs. 1000 and 10 make up
+; the hot 99% of the 1013 estimated header runs.
+
+; CHECK-LABEL: define i32 @main(
+; CHECK: br i1 %more, label %loop, label %done, !llvm.loop [[MAIN:![0-9]+]]
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %loop ]
+  call void @work()
+  %inc = add nuw nsw i32 %i, 1
+  %more = icmp ult i32 %inc, 10
+  br i1 %more, label %loop, label %done
+
+done:
+  call void @rare()
+  ret i32 0
+}
+
+; CHECK-LABEL: define internal void @work(
+; CHECK: br i1 %more, label %loop, label %done, !llvm.loop [[WORK:![0-9]+]]
+define internal void @work() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %loop ]
+  %inc = add nuw nsw i32 %i, 1
+  %more = icmp ult i32 %inc, 100
+  br i1 %more, label %loop, label %done
+
+done:
+  ret void
+}
+
+; CHECK-LABEL: define internal void @rare(
+; CHECK: br i1 %more, label %loop, label %done, !llvm.loop [[RARE:![0-9]+]]
+define internal void @rare() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %loop ]
+  %inc = add nuw nsw i32 %i, 1
+  %more = icmp ult i32 %inc, 3
+  br i1 %more, label %loop, label %done
+
+done:
+  ret void
+}
+
+; CHECK: [[MAIN]] = distinct !{[[MAIN]], {{.*}}, [[MAIN_EST:![0-9]+]]}
+; CHECK: [[MAIN_EST]] = !{!"cla.est", !"hot", i64 10}
+; CHECK: [[WORK]] = distinct !{[[WORK]], {{.*}}, [[WORK_EST:![0-9]+]]}
+; CHECK: [[WORK_EST]] = !{!"cla.est", !"hot", i64 1000}
+; CHECK: [[RARE]] = distinct !{[[RARE]], {{.*}}, [[RARE_EST:![0-9]+]]}
+; CHECK: [[RARE_EST]] = !{!"cla.est", !"cold", i64 3}
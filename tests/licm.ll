@@ -0,0 +1,85 @@
+; -licm: what is invariant and safe moves to the preheader, which is made
+; when missing; loads a store in the loop may overwrite and divisions that
+; may trap stay where they are.
+
+; The multiply, the load through a pointer the loop's store cannot reach
+; and the add of both all move out.
+; CHECK-LABEL: define void @hoist(
+; CHECK: entry:
+; CHECK-NEXT: %xy = mul i32 %x, %y
+; CHECK-NEXT: %k = load i32, i32* %c
+; CHECK-NEXT: %v = add i32 %xy, %k
+; CHECK-NEXT: br label %loop
+; CHECK: loop:
+; CHECK-NOT: load
+; CHECK: store i32 %v
+define void @hoist(i32* noalias %a, i32* %c, i32 %x, i32 %y, i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %loop ]
+  %xy = mul i32 %x, %y
+  %k = load i32, i32* %c
+  %v = add i32 %xy, %k
+  %p = getelementptr inbounds i32, i32* %a, i32 %i
+  store i32 %v, i32* %p
+  %inc = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %inc, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; %a may alias %b, so the store can change what the load reads.
+; CHECK-LABEL: define void @aliasing(
+; CHECK: entry:
+; CHECK-NEXT: br label %loop
+; CHECK: loop:
+; CHECK: %v = load i32, i32* %b
+define void @aliasing(i32* %a, i32* %b, i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %loop ]
+  %v = load i32, i32* %b
+  %v1 = add i32 %v, 1
+  %p = getelementptr inbounds i32, i32* %a, i32 %i
+  store i32 %v1, i32* %p
+  %inc = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %inc, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; The loop is entered from a branch, so a preheader is made for it. Division
+; by the constant 7 moves there; division by %d may trap and stays.
+; CHECK-LABEL: define void @trapping(
+; CHECK: loop.preheader:
+; CHECK-NEXT: %r = sdiv i32 %x, 7
+; CHECK-NEXT: br label %loop
+; CHECK: loop:
+; CHECK: %q = sdiv i32 %x, %d
+define void @trapping(i32* %a, i32 %x, i32 %d, i32 %n) {
+entry:
+  %skip = icmp eq i32 %n, 0
+  br i1 %skip, label %exit, label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %loop ]
+  %q = sdiv i32 %x, %d
+  %r = sdiv i32 %x, 7
+  %s = add i32 %q, %r
+  %p = getelementptr inbounds i32, i32* %a, i32 %i
+  store i32 %s, i32* %p
+  %inc = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %inc, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret void
+}
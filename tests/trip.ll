@@ -0,0 +1,195 @@
+; Static trip counts, in header runs. Memory IVs (-O0 style, the allocas
+; below) are counted by cla itself, including the unsigned, non-dividing and
+; overflowing edge cases; register IVs are counted by SCEV.
+
+; i = 0; while (i != 12) i += 3: four iterations, five header runs
+; CHECK-LABEL: define void @ne_exact(
+; CHECK: br label %cond, !llvm.loop [[NE_EXACT:![0-9]+]]
+define void @ne_exact() {
+entry:
+  %i = alloca i32
+  store i32 0, i32* %i
+  br label %cond
+
+cond:
+  %v = load i32, i32* %i
+  %c = icmp ne i32 %v, 12
+  br i1 %c, label %body, label %exit
+
+body:
+  %w = load i32, i32* %i
+  %next = add i32 %w, 3
+  store i32 %next, i32* %i
+  br label %cond
+
+exit:
+  ret void
+}
+
+; i = 0; while (i != 10) i += 3 steps over the bound and would wrap
+; CHECK-LABEL: define void @ne_skips(
+; CHECK: br label %cond, !llvm.loop [[NE_SKIPS:![0-9]+]]
+define void @ne_skips() {
+entry:
+  %i = alloca i32
+  store i32 0, i32* %i
+  br label %cond
+
+cond:
+  %v = load i32, i32* %i
+  %c = icmp ne i32 %v, 10
+  br i1 %c, label %body, label %exit
+
+body:
+  %w = load i32, i32* %i
+  %next = add i32 %w, 3
+  store i32 %next, i32* %i
+  br label %cond
+
+exit:
+  ret void
+}
+
+; unsigned i8 from 100 while below 200 by 10; signed, 200 would be -56
+; CHECK-LABEL: define void @ult(
+; CHECK: br label %cond, !llvm.loop [[ULT:![0-9]+]]
+define void @ult() {
+entry:
+  %i = alloca i8
+  store i8 100, i8* %i
+  br label %cond
+
+cond:
+  %v = load i8, i8* %i
+  %c = icmp ult i8 %v, 200
+  br i1 %c, label %body, label %exit
+
+body:
+  %w = load i8, i8* %i
+  %next = add i8 %w, 10
+  store i8 %next, i8* %i
+  br label %cond
+
+exit:
+  ret void
+}
+
+; i8 from 0 while below 127 by 2: reaching 128 would wrap
+; CHECK-LABEL: define void @slt_wraps(
+; CHECK: br label %cond, !llvm.loop [[SLT_WRAPS:![0-9]+]]
+define void @slt_wraps() {
+entry:
+  %i = alloca i8
+  store i8 0, i8* %i
+  br label %cond
+
+cond:
+  %v = load i8, i8* %i
+  %c = icmp slt i8 %v, 127
+  br i1 %c, label %body, label %exit
+
+body:
+  %w = load i8, i8* %i
+  %next = add i8 %w, 2
+  store i8 %next, i8* %i
+  br label %cond
+
+exit:
+  ret void
+}
+
+; counting down from 0 to INT64_MIN would divide INT64_MIN by -1
+; CHECK-LABEL: define void @sge_min(
+; CHECK: br label %cond, !llvm.loop [[SGE_MIN:![0-9]+]]
+define void @sge_min() {
+entry:
+  %i = alloca i64
+  store i64 0, i64* %i
+  br label %cond
+
+cond:
+  %v = load i64, i64* %i
+  %c = icmp sge i64 %v, -9223372036854775808
+  br i1 %c, label %body, label %exit
+
+body:
+  %w = load i64, i64* %i
+  %next = add i64 %w, -1
+  store i64 %next, i64* %i
+  br label %cond
+
+exit:
+  ret void
+}
+
+; the same with "!=" as the exit test
+; CHECK-LABEL: define void @ne_min(
+; CHECK: br label %cond, !llvm.loop [[NE_MIN:![0-9]+]]
+define void @ne_min() {
+entry:
+  %i = alloca i64
+  store i64 0, i64* %i
+  br label %cond
+
+cond:
+  %v = load i64, i64* %i
+  %c = icmp ne i64 %v, -9223372036854775808
+  br i1 %c, label %body, label %exit
+
+body:
+  %w = load i64, i64* %i
+  %next = add i64 %w, -1
+  store i64 %next, i64* %i
+  br label %cond
+
+exit:
+  ret void
+}
+
+; the exact count SCEV finds for an "!=" exit
+; CHECK-LABEL: define void @scev_ne(
+; CHECK: br i1 %c, label %loop, label %exit, !llvm.loop [[SCEV_NE:![0-9]+]]
+define void @scev_ne() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %loop ]
+  %next = add nuw nsw i32 %i, 3
+  %c = icmp ne i32 %next, 12
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; an unknown unsigned bound leaves the largest i8 count
+; CHECK-LABEL: define void @scev_max(
+; CHECK: br i1 %c, label %loop, label %exit, !llvm.loop [[SCEV_MAX:![0-9]+]]
+define void @scev_max(i8 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i8 [ 0, %entry ], [ %next, %loop ]
+  %next = add nuw i8 %i, 1
+  %c = icmp ult i8 %next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; CHECK-DAG: [[NE_EXACT]] = distinct !{[[NE_EXACT]], {{.*}}, [[NE_EXACT_TRIP:![0-9]+]]}
+; CHECK-DAG: [[NE_EXACT_TRIP]] = !{!"cla.trip", !"exact", i64 5}
+; CHECK-DAG: [[NE_SKIPS]] = distinct !{[[NE_SKIPS]], {{.*}}, [[UNKNOWN:![0-9]+]]}
+; CHECK-DAG: [[UNKNOWN]] = !{!"cla.trip", !"unknown"}
+; CHECK-DAG: [[ULT]] = distinct !{[[ULT]], {{.*}}, [[ULT_TRIP:![0-9]+]]}
+; CHECK-DAG: [[ULT_TRIP]] = !{!"cla.trip", !"exact", i64 11}
+; CHECK-DAG: [[SLT_WRAPS]] = distinct !{[[SLT_WRAPS]], {{.*}}, [[UNKNOWN]]}
+; CHECK-DAG: [[SGE_MIN]] = distinct !{[[SGE_MIN]], {{.*}}, [[UNKNOWN]]}
+; CHECK-DAG: [[NE_MIN]] = distinct !{[[NE_MIN]], {{.*}}, [[UNKNOWN]]}
+; CHECK-DAG: [[SCEV_NE]] = distinct !{[[SCEV_NE]], {{.*}}, [[SCEV_NE_TRIP:![0-9]+]]}
+; CHECK-DAG: [[SCEV_NE_TRIP]] = !{!"cla.trip", !"exact", i64 4}
+; CHECK-DAG: [[SCEV_MAX]] = distinct !{[[SCEV_MAX]], {{.*}}, [[SCEV_MAX_TRIP:![0-9]+]]}
+; CHECK-DAG: [[SCEV_MAX_TRIP]] = !{!"cla.trip", !"max", i64 255}
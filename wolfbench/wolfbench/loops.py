@@ -0,0 +1,51 @@
+#!/usr/bin/env python
+
+# Rank the loops recorded by cla -loop-records across the whole suite.
+#   loops.py [-n N] [-k field] file.loops.jsonl ...
+# Loops are ordered by nesting depth, then by the chosen size field
+# (instructions by default). The hotness fields (iterations from
+# -use-profile, est_weight from -static-hotness) rank on their own. Loop
+# ids are the stable ids cla also puts in the cla.loop metadata, so they
+# match across runs and optimization levels.
+
+import sys
+import json
+
+top = 20
+key = 'instructions'
+files = []
+
+args = sys.argv[1:]
+while args:
+    a = args.pop(0)
+    if a == '-n':
+        top = int(args.pop(0))
+    elif a == '-k':
+        key = args.pop(0)
+    else:
+        files.append(a)
+
+loops = []
+for fName in files:
+    bench = fName.split('/')[-1].split('.')[0]
+    for line in open(fName):
+        if line.strip():
+            r = json.loads(line)
+            r['bench'] = bench
+            loops.append(r)
+
+# fields such as iterations are null for loops without a value
+if key in ('iterations', 'est_weight'):
+    loops.sort(key=lambda r: r[key] or 0, reverse=True)
+else:
+    loops.sort(key=lambda r: (r['depth'], r[key] or 0), reverse=True)
+
+print("%-12s %-16s %-20s %-24s %5s %6s %5s %6s %5s %-6s %-12s" %
+      ("Benchmark", "Loop", "Function", "Location", "Depth", key[:6].capitalize(), "Loads",
+       "Stores", "Calls", "IV", "Trips"))
+for r in loops[:top]:
+    trips = r['trip_count'] if r['trip'] == 'exact' else r['trip']
+    print("%-12s %-16s %-20s %-24s %5d %6d %5d %6d %5d %-6s %-12s" %
+          (r['bench'], r['id'], r['function'][:20], r['location'][:24], r['depth'], r[key] or 0,
+           r['loads'], r['stores'], r['calls'], r['iv'], trips[:12]))
+print("%d loops in %d files" % (len(loops), len(files)))